@@ -0,0 +1,268 @@
+#ifndef ALPHABET_MAP_H
+#define ALPHABET_MAP_H
+
+#include<cstdint>
+#include<cstdlib>
+#include<limits>
+#include<string>
+#include<vector>
+#include<iostream>
+#include<fstream>
+#include<algorithm>
+
+#include "query_io.h"
+
+
+// Symbol of a text at index i; a text is either a string of characters (bytes), or a sequence
+// of 32-bit integer symbols (e.g. token IDs, or Unicode code points).
+
+inline uint32_t symbol_at(const std::string &text, uint64_t i) { return (uint8_t)text[i]; }
+inline uint32_t symbol_at(const std::vector<uint32_t> &text, uint64_t i) { return text[i]; }
+
+
+
+// Compact mapping of the distinct symbols of a text to the codes [0, sigma), held in two flat
+// arrays: the symbols in increasing order along with their codes, searched by binary search;
+// and the symbol of each code. The codes follow the symbol order, unless remapped (e.g. to the
+// order of their Huffman codes). Only the symbol of each code is serialized.
+
+class alphabet_map
+{
+private:
+    bool bytes;                     // Whether the symbols are text characters, or integers.
+    std::vector<uint32_t> sym;      // Distinct symbols, in increasing order.
+    std::vector<uint32_t> symCode;  // Code of each symbol of sym.
+    std::vector<uint32_t> codeSym;  // Symbol of each code.
+
+
+    void index_codes();
+
+
+public:
+    alphabet_map() { bytes = true; }
+
+    void build(const std::string &text);
+    void build(const std::vector<uint32_t> &text);
+    void remap(const std::vector<uint32_t> &order);
+
+    uint64_t size() const { return sym.size(); }
+    bool is_bytes() const { return bytes; }
+    bool is_ordered() const { return std::is_sorted(codeSym.begin(), codeSym.end()); }
+    uint64_t count_less(uint32_t symbol) const { return std::lower_bound(sym.begin(), sym.end(), symbol) - sym.begin(); }
+    inline bool find(uint32_t symbol, uint32_t &code) const;
+    inline uint32_t code(uint32_t symbol) const;
+    inline uint32_t symbol(uint32_t code) const { return codeSym[code]; }
+
+    bool read_symbol(query_reader &input, uint32_t &symbol) const { return input.read_symbol(symbol, bytes); }
+    void write_symbol(std::ostream &output, uint32_t code) const;
+    void append_symbol(std::string &output, uint32_t code) const;
+
+    void serialize(std::ofstream &output);
+    template<typename T_input> bool deserialize(T_input &input);
+};
+
+
+
+void alphabet_map::build(const std::string &text)
+{
+    bool seen[256] = {false};
+
+    for(uint64_t i = 0; i < text.length(); ++i)
+        seen[(uint8_t)text[i]] = true;
+
+    bytes = true;
+    sym.clear();
+
+    for(uint32_t c = 0; c < 256; ++c)
+        if(seen[c])
+            sym.push_back(c);
+
+    codeSym = sym;
+    index_codes();
+}
+
+
+
+void alphabet_map::build(const std::vector<uint32_t> &text)
+{
+    bytes = false;
+    sym = text;
+
+    std::sort(sym.begin(), sym.end());
+    sym.erase(std::unique(sym.begin(), sym.end()), sym.end());
+    sym.shrink_to_fit();
+
+    codeSym = sym;
+    index_codes();
+}
+
+
+
+void alphabet_map::remap(const std::vector<uint32_t> &order)
+{
+    // The new code i is given to the symbol of the current code order[i].
+
+    std::vector<uint32_t> newSym(order.size());
+
+    for(uint64_t i = 0; i < order.size(); ++i)
+        newSym[i] = codeSym[order[i]];
+
+    codeSym.swap(newSym);
+    index_codes();
+}
+
+
+
+void alphabet_map::index_codes()
+{
+    // Sorts the symbols of the codes, keeping the code of each.
+
+    std::vector<std::pair<uint32_t, uint32_t>> pairs(codeSym.size());
+
+    for(uint64_t c = 0; c < codeSym.size(); ++c)
+        pairs[c] = std::make_pair(codeSym[c], c);
+
+    std::sort(pairs.begin(), pairs.end());
+
+    sym.resize(pairs.size()), symCode.resize(pairs.size());
+
+    for(uint64_t i = 0; i < pairs.size(); ++i)
+        sym[i] = pairs[i].first, symCode[i] = pairs[i].second;
+}
+
+
+
+bool alphabet_map::find(uint32_t symbol, uint32_t &code) const
+{
+    auto p = std::lower_bound(sym.begin(), sym.end(), symbol);
+
+    if(p == sym.end() || *p != symbol)
+        return false;
+
+    code = symCode[p - sym.begin()];
+    return true;
+}
+
+
+
+uint32_t alphabet_map::code(uint32_t symbol) const
+{
+    // The symbol must be in the alphabet.
+
+    return symCode[std::lower_bound(sym.begin(), sym.end(), symbol) - sym.begin()];
+}
+
+
+
+void alphabet_map::write_symbol(std::ostream &output, uint32_t code) const
+{
+    if(bytes)
+        output << (char)codeSym[code];
+    else
+        output << codeSym[code];
+}
+
+
+
+void alphabet_map::append_symbol(std::string &output, uint32_t code) const
+{
+    if(bytes)
+        output += (char)codeSym[code];
+    else
+        append_int(output, codeSym[code]);
+}
+
+
+
+void alphabet_map::serialize(std::ofstream &output)
+{
+    // Serialize the kind of the symbols, the alphabet size, and the symbol of each code.
+
+    uint8_t kind = bytes;
+    uint64_t sigma = codeSym.size();
+
+    output.write((const char *)&kind, sizeof(kind));
+    output.write((const char *)&sigma, sizeof(sigma));
+    output.write((const char *)codeSym.data(), sigma * sizeof(uint32_t));
+}
+
+
+
+template<typename T_input>
+bool alphabet_map::deserialize(T_input &input)
+{
+    uint8_t kind = 0;
+    uint64_t sigma = 0;
+
+    input.read((char *)&kind, sizeof(kind));
+    input.read((char *)&sigma, sizeof(sigma));
+
+    if(!input || sigma > (1ULL << 32))
+        return false;
+
+    bytes = kind;
+    codeSym.resize(sigma);
+    input.read((char *)codeSym.data(), sigma * sizeof(uint32_t));
+
+    index_codes();
+
+    return (bool)input;
+}
+
+
+
+// Parses a whitespace-separated token of an integer text: digits only, of a value of at most
+// UINT32_MAX. Any other token (e.g. signed, or too large) is reported, naming it and the file
+// it is in, and exits; rather than skipped, or wrapped into a different symbol.
+
+inline uint32_t parse_symbol_token(const std::string &token, const std::string &fileName)
+{
+    uint64_t val = 0;
+    bool valid = !token.empty();
+
+    for(uint64_t i = 0; valid && i < token.length(); ++i)
+    {
+        valid = (token[i] >= '0' && token[i] <= '9');
+        val = val * 10 + (token[i] - '0');
+        valid = valid && val <= std::numeric_limits<uint32_t>::max();
+    }
+
+    if(!valid)
+    {
+        std::cerr << "Invalid symbol \"" << token << "\" in " << fileName
+                    << "; the symbols of an integer text are unsigned integers of at most 4294967295.\n";
+        exit(1);
+    }
+
+    return val;
+}
+
+
+
+// Reads a text file: a line of characters; or, for integer symbols, whitespace-separated
+// unsigned integers.
+
+inline void read_text(const std::string &fileName, std::string &text)
+{
+    std::ifstream input(fileName);
+    std::getline(input, text);
+}
+
+
+
+inline void read_text(const std::string &fileName, std::vector<uint32_t> &text)
+{
+    // Every token is validated, like by stream_builder's reader; so a malformed one stops the
+    // build, instead of ending the text early.
+
+    std::ifstream input(fileName);
+    std::string token;
+
+    text.clear();
+    while(input >> token)
+        text.push_back(parse_symbol_token(token, fileName));
+}
+
+
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef BATCH_EXECUTOR_H
+#define BATCH_EXECUTOR_H
+
+#include<cstdint>
+#include<vector>
+#include<string>
+#include<ostream>
+#include<functional>
+#include<algorithm>
+
+#include "task_pool.h"
+
+
+// Runs a batch of queries with many of them in flight at a time. Each query is a state
+// machine with two operations: start(), which prefetches the memory its first step touches,
+// and step(), which advances it by one level, prefetches the memory its next step touches,
+// and returns whether it has more steps to go. Up to window queries are stepped round-robin;
+// so the cache misses of a query overlap with the steps of the others, instead of the CPU
+// stalling on every level of one query at a time. A finished query's slot is refilled with
+// the next query of the batch.
+
+template<typename T_query>
+void run_interleaved(std::vector<T_query> &queries, uint64_t window = 32)
+{
+    std::vector<uint64_t> slot(window);
+    uint64_t inFlight = 0, next = 0, qCount = queries.size();
+
+    for(; inFlight < window && next < qCount; ++next)
+    {
+        queries[next].start();
+        slot[inFlight++] = next;
+    }
+
+
+    while(inFlight)
+        for(uint64_t i = 0; i < inFlight; )
+            if(queries[slot[i]].step())
+                i++;
+            else if(next < qCount)
+            {
+                queries[next].start();
+                slot[i++] = next++;
+            }
+            else
+                slot[i] = slot[--inFlight];
+}
+
+
+
+
+// Answers qCount queries in chunks of chunkLen, on the threads of pool (or on the calling thread,
+// if NULL), and writes their results to output in the query order: answer(b, e, out) answers
+// the queries [b, e) and appends their results to out. The chunks are run in rounds of a few per
+// thread, whose buffers are written out in order once the round is over; so only the results of
+// a round are held at a time, however long the query file.
+
+void run_chunked(uint64_t qCount, task_pool *pool, std::ostream &output,
+                    const std::function<void(uint64_t, uint64_t, std::string &)> &answer, uint64_t chunkLen = 1 << 16)
+{
+    uint64_t chunkCount = (qCount + chunkLen - 1) / chunkLen;
+    uint64_t roundLen = (pool ? 4 * (uint64_t)pool -> thread_count() : 1);
+    std::vector<std::string> buf(roundLen);
+
+    for(uint64_t first = 0; first < chunkCount; first += roundLen)
+    {
+        uint64_t count = std::min(roundLen, chunkCount - first);
+
+        auto run = [&](uint64_t i)
+            {
+                uint64_t b = (first + i) * chunkLen;
+
+                buf[i].clear();
+                answer(b, std::min(b + chunkLen, qCount), buf[i]);
+            };
+
+        if(pool)
+            pool -> parallel_for(count, run);
+        else
+            run(0);
+
+        for(uint64_t i = 0; i < count; ++i)
+            output.write(buf[i].data(), buf[i].size());
+    }
+}
+
+
+
+#endif
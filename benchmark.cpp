@@ -1,317 +1,813 @@
+#include<cstdio>
 #include<cstring>
+#include<cstdlib>
+#include<string>
+#include<vector>
+#include<memory>
+#include<algorithm>
 #include<chrono>
 #include<random>
-#include<vector>
 
 #include "wavelet_tree.h"
+#include "wavelet_matrix.h"
+#include "rank_support_poppy.h"
+#include "rank_select_support.h"
+#include "ef_vector.h"
+#include "dynamic_bit_vector.h"
+#include "perf_counters.h"
+
+
+// Microbenchmarks of the bitvector, rank / select support, and wavelet tree (matrix) operations.
+//
+// Every query benchmark pre-generates its queries, warms up, and then measures:
+//  * the throughput, with one timer pair around the whole query loop; and
+//  * the latency distribution, with a timer pair around each run of LAT_BATCH queries, since
+//    a timer pair around every single query would cost about as much as the query itself.
+// The batch benchmarks (*_batch) time the batch query APIs as a whole, and the build benchmarks
+// (*_build) time the construction; these report no latency distribution.
+//
+// Reported per benchmark and parameter combination, as CSV or JSON:
+//  * ns_per_op: median over the repeats of the mean time per query (or per element, for builds);
+//  * mops: millions of queries (elements) per second;
+//  * p50_ns, p90_ns, p99_ns: percentiles of the per-query latency;
+//  * bits_per_elem: for the bitvector structures, the space overhead on top of the bitvector
+//    per bit; for the wavelet trees and matrices, their total size per text symbol.
+// With --perf, also the hardware counts per query (element) of the measured throughput loops
+// (cycles, instructions, llc_misses, dtlb_misses, branch_misses; see perf_counters.h), and, if
+// built with WT_COUNT_OPS, their node operations and rank1 calls per query (node_ops, rank1_calls).
+
+
+const uint64_t LAT_BATCH = 16;          // Queries per latency sample.
+const uint64_t WARMUP_QUERIES = 100000; // Queries to run before measuring.
+
+typedef std::chrono::steady_clock bench_clock;
+
+volatile uint64_t sink; // Accumulates the query answers, so that the queries are not optimized away.
+bool profile = false;   // Whether to read the performance counters around the measured loops (--perf).
+
+
+struct bench_config
+{
+    std::vector<std::string> benchmarks;
+    std::vector<double> n;          // Bitvector lengths, or text lengths.
+    std::vector<double> sigma;      // Alphabet sizes of the texts.
+    std::vector<double> density;    // Densities of ones in the bitvectors.
+    uint64_t queryCount;
+    unsigned repeat;
+    uint64_t seed;
+    bool json;
+};
+
+
+struct measurement
+{
+    double nsPerOp;
+    double p50, p90, p99;   // Negative if not measured.
+    double events[perf_counters::EVENT_COUNT];  // Counts per op, with --perf; negative if not measured.
+    double nodeOps, rankCalls;                  // Likewise, with WT_COUNT_OPS too.
+};
 
 
-void benchmark_rank(uint64_t startLen, uint64_t endLen, uint64_t stepSize, uint64_t queryCount)
+struct bench_row
 {
-    puts("Benchmarking of rank queries.\n");
-    printf("n\t\tTime(s)\t\tOverhead\n==========\n");
+    std::string benchmark;
+    uint64_t n;
+    uint64_t sigma;         // 0 for the bitvector benchmarks.
+    double density;         // Negative for the text benchmarks.
+    uint64_t queryCount;
+    double bitsPerElem;
+    measurement m;
+};
 
-    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    double elapsedSecs;
-    
-    for(uint64_t bitCount = startLen; bitCount <= endLen; bitCount += stepSize)
-    {
-        bit_vector b;
-        b.generate_random_bitvector(bitCount);
-        
-        rank_support r(&b);
 
-        elapsedSecs = 0;
-        for(uint64_t i = 0; i < queryCount; ++i)
-        {
-            uint64_t queryIdx = std::uniform_int_distribution<uint64_t>(0, bitCount - 1)(rng);
 
-            std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
-            r.rank1(queryIdx);
-            std::chrono::high_resolution_clock::time_point t_end = std::chrono::high_resolution_clock::now();
+inline double elapsed_ns(bench_clock::time_point start, bench_clock::time_point end)
+{
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
 
-            std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(t_end - t_start);
-            elapsedSecs += time_span.count();
-        }
+
+inline double percentile(std::vector<double> &sorted, double p)
+{
+    return sorted[std::min<uint64_t>(sorted.size() - 1, p * sorted.size())];
+}
 
 
-        printf("%llu\t\t%lf\t\t%llu\n", (unsigned long long)bitCount, elapsedSecs, (unsigned long long)r.overhead());
+
+// Sets the counts per op of m to those of counters (if any) over opCount operations.
+void record_counts(measurement &m, perf_counters *counters, uint64_t opCount)
+{
+    for(int e = 0; e < perf_counters::EVENT_COUNT; ++e)
+        m.events[e] = (counters ? counters -> per_op((perf_counters::event)e, opCount) : -1);
+
+    m.nodeOps = m.rankCalls = -1;
+
+#ifdef WT_COUNT_OPS
+    if(counters)
+    {
+        const op_counts &total = counters -> op_counts_total();
+        m.nodeOps = m.rankCalls = 0;
+
+        for(uint8_t l = 0; l < op_counts::MAX_LEVELS; ++l)
+            m.nodeOps += total.nodeOps[l], m.rankCalls += total.rankCalls[l];
+
+        m.nodeOps /= opCount, m.rankCalls /= opCount;
     }
+#endif
 }
 
 
 
-void benchmark_select(uint64_t startLen, uint64_t endLen, uint64_t stepSize, uint64_t queryCount)
+// Measures query(0), ..., query(queryCount - 1), where query(i) answers the i'th
+// pre-generated query.
+template<typename T_query>
+measurement measure(uint64_t queryCount, unsigned repeat, T_query query)
 {
-    puts("Benchmarking of select queries.\n");
-    printf("n\t\tTime(s)\t\tOverhead\n==========\n");
+    uint64_t acc = 0;
+
+    for(uint64_t i = 0; i < std::min(queryCount, WARMUP_QUERIES); ++i)
+        acc += query(i);
+
+
+    std::vector<double> nsPerOp, latency;
+    std::unique_ptr<perf_counters> counters(profile ? new perf_counters() : NULL);
 
-    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    double elapsedSecs;
-    
-    for(uint64_t bitCount = startLen; bitCount <= endLen; bitCount += stepSize)
+    for(unsigned r = 0; r < repeat; ++r)
     {
-        bit_vector b;
-        b.generate_random_bitvector(bitCount);
-        
-        rank_support r(&b);
-        select_support s(&r);
+        if(counters)
+            counters -> start();
 
-        uint64_t maxRank1 = r.rank1(bitCount - 1);
+        bench_clock::time_point start = bench_clock::now();
 
-        elapsedSecs = 0;
         for(uint64_t i = 0; i < queryCount; ++i)
+            acc += query(i);
+
+        nsPerOp.push_back(elapsed_ns(start, bench_clock::now()) / queryCount);
+
+        if(counters)
+            counters -> stop();
+
+
+        for(uint64_t first = 0; first < queryCount; first += LAT_BATCH)
         {
-            uint64_t queryRank = std::uniform_int_distribution<uint64_t>(1, maxRank1)(rng);
+            uint64_t last = std::min(first + LAT_BATCH, queryCount);
+            bench_clock::time_point batchStart = bench_clock::now();
 
-            std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
-            s.select1(queryRank);
-            std::chrono::high_resolution_clock::time_point t_end = std::chrono::high_resolution_clock::now();
+            for(uint64_t i = first; i < last; ++i)
+                acc += query(i);
 
-            std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(t_end - t_start);
-            elapsedSecs += time_span.count();
+            latency.push_back(elapsed_ns(batchStart, bench_clock::now()) / (last - first));
         }
+    }
 
+    sink += acc;
 
-        printf("%llu\t\t%lf\t\t%llu\n", (unsigned long long)bitCount, elapsedSecs, (unsigned long long)s.overhead());
-    }
+
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    std::sort(latency.begin(), latency.end());
+
+    measurement m = {percentile(nsPerOp, 0.5), percentile(latency, 0.5), percentile(latency, 0.9), percentile(latency, 0.99),
+                        {}, -1, -1};
+    record_counts(m, counters.get(), queryCount * repeat);
+
+    return m;
 }
 
 
 
-void benchmark_wt_rank_fixed_alphabet(uint64_t startLen, uint64_t endLen, uint64_t stepSize, uint64_t queryCount)
+// Measures run(), which performs opCount operations (a query batch, or a construction) at once.
+template<typename T_run>
+measurement measure_whole(uint64_t opCount, unsigned repeat, T_run run)
 {
-    puts("Benchmarking of wavelet tree rank queries with fixed alphabet size (100).\n");
-    printf("n\t\tTime(s)\t\tOverhead\n==========\n");
+    std::vector<double> nsPerOp;
+    std::unique_ptr<perf_counters> counters(profile ? new perf_counters() : NULL);
 
-    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    double elapsedSecs;
-    
-    for(uint64_t len = startLen; len <= endLen; len += stepSize)
+    for(unsigned r = 0; r < repeat; ++r)
     {
-        char *s = new char[len + 1];
-        for(uint64_t i = 0; i < len; ++i)
-            while((s[i] = std::uniform_int_distribution<uint64_t>(1, 100)(rng)) == '\n');
+        if(counters)
+            counters -> start();
 
-        s[len] = '\0';
-       
-        // puts(s);
-        // for(int i = 0; i < len; ++i)
-        //     printf("%d --> %d\n", i, s[i]);
+        bench_clock::time_point start = bench_clock::now();
+        sink += run();
+        nsPerOp.push_back(elapsed_ns(start, bench_clock::now()) / opCount);
 
-        std::string text(s);
-        wavelet_tree w(text);
-       
+        if(counters)
+            counters -> stop();
+    }
 
-        elapsedSecs = 0;
-        for(uint64_t i = 0; i < queryCount; ++i)
-        {
-            uint64_t queryIdx = std::uniform_int_distribution<uint64_t>(0, len - 1)(rng);
+    std::sort(nsPerOp.begin(), nsPerOp.end());
 
-            std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
-            w.rank(queryIdx);
-            std::chrono::high_resolution_clock::time_point t_end = std::chrono::high_resolution_clock::now();
+    measurement m = {percentile(nsPerOp, 0.5), -1, -1, -1, {}, -1, -1};
+    record_counts(m, counters.get(), opCount * repeat);
+
+    return m;
+}
 
-            std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(t_end - t_start);
-            elapsedSecs += time_span.count();
-        }
 
 
-        delete(s);
+void print_header(bool json)
+{
+    if(json)
+        puts("[");
+    else
+    {
+        fputs("benchmark,n,sigma,density,queries,ns_per_op,mops,p50_ns,p90_ns,p99_ns,bits_per_elem", stdout);
 
+        if(profile)
+            for(int e = 0; e < perf_counters::EVENT_COUNT; ++e)
+                printf(",%s", perf_counters::name((perf_counters::event)e));
+#ifdef WT_COUNT_OPS
+        if(profile)
+            fputs(",node_ops,rank1_calls", stdout);
+#endif
 
-        printf("%llu\t\t%lf\n", (unsigned long long)len, elapsedSecs);
+        puts("");
     }
 }
 
 
 
-void benchmark_wt_select_fixed_alphabet(uint64_t startLen, uint64_t endLen, uint64_t stepSize, uint64_t queryCount)
+void print_footer(bool json)
 {
-    puts("Benchmarking of wavelet tree select queries with fixed alphabet size (100).\n");
-    printf("n\t\tTime(s)\t\tOverhead\n==========\n");
-
-    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    double elapsedSecs;
-    uint64_t H[256];
-    
-    for(uint64_t len = startLen; len <= endLen; len += stepSize)
-    {
-        std::map<char, uint8_t> charMap;
-        memset(H, 0, sizeof H);
+    if(json)
+        puts("\n]");
+}
 
-        char *s = new char[len + 1];
-        for(uint64_t i = 0; i < len; ++i)
+
+
+void print_row(const bench_row &row, bool json)
+{
+    static bool first = true;
+
+    // The unmeasured fields are left empty in CSV, and null in JSON.
+    char sigma[32] = "", density[32] = "", p[3][32] = {"", "", ""};
+    double pVal[3] = {row.m.p50, row.m.p90, row.m.p99};
+    const char *none = (json ? "null" : "");
+
+    snprintf(sigma, sizeof(sigma), "%s", none);
+    snprintf(density, sizeof(density), "%s", none);
+    if(row.sigma)
+        snprintf(sigma, sizeof(sigma), "%llu", (unsigned long long)row.sigma);
+    if(row.density >= 0)
+        snprintf(density, sizeof(density), "%g", row.density);
+
+    for(int i = 0; i < 3; ++i)
+        if(pVal[i] >= 0)
+            snprintf(p[i], sizeof(p[i]), "%.2f", pVal[i]);
+        else
+            snprintf(p[i], sizeof(p[i]), "%s", none);
+
+
+    if(json)
+        printf("%s  {\"benchmark\": \"%s\", \"n\": %llu, \"sigma\": %s, \"density\": %s, \"queries\": %llu, "
+                "\"ns_per_op\": %.2f, \"mops\": %.3f, \"p50_ns\": %s, \"p90_ns\": %s, \"p99_ns\": %s, \"bits_per_elem\": %.4f",
+                first ? "" : ",\n", row.benchmark.c_str(), (unsigned long long)row.n, sigma, density,
+                (unsigned long long)row.queryCount, row.m.nsPerOp, 1e3 / row.m.nsPerOp, p[0], p[1], p[2], row.bitsPerElem);
+    else
+        printf("%s,%llu,%s,%s,%llu,%.2f,%.3f,%s,%s,%s,%.4f",
+                row.benchmark.c_str(), (unsigned long long)row.n, sigma, density,
+                (unsigned long long)row.queryCount, row.m.nsPerOp, 1e3 / row.m.nsPerOp, p[0], p[1], p[2], row.bitsPerElem);
+
+    if(profile)
+    {
+        // The counts, as further fields ahead of the closing brace in JSON.
+        double val[perf_counters::EVENT_COUNT + 2];
+        const char *name[perf_counters::EVENT_COUNT + 2];
+        int fieldCount = perf_counters::EVENT_COUNT;
+
+        for(int e = 0; e < perf_counters::EVENT_COUNT; ++e)
+            val[e] = row.m.events[e], name[e] = perf_counters::name((perf_counters::event)e);
+#ifdef WT_COUNT_OPS
+        val[fieldCount] = row.m.nodeOps, name[fieldCount++] = "node_ops";
+        val[fieldCount] = row.m.rankCalls, name[fieldCount++] = "rank1_calls";
+#endif
+
+        for(int f = 0; f < fieldCount; ++f)
         {
-            while((s[i] = std::uniform_int_distribution<uint64_t>(1, 100)(rng)) == '\n');
-            H[s[i]]++;
-            
-            if(charMap.find(s[i]) == charMap.end())
-                charMap[s[i]] = 0;
+            char field[32];
+
+            if(val[f] >= 0)
+                snprintf(field, sizeof(field), "%.3f", val[f]);
+            else
+                snprintf(field, sizeof(field), "%s", none);
+
+            if(json)
+                printf(", \"%s\": %s", name[f], field);
+            else
+                printf(",%s", field);
         }
+    }
 
-        uint8_t distinct = 0;
-        for(auto p = charMap.begin(); p != charMap.end(); ++p)
-            p -> second = distinct++;
+    fputs(json ? "}" : "\n", stdout);
+    first = false;
+    fflush(stdout);
+}
 
-        s[len] = '\0';
 
-        std::string text(s);
-        wavelet_tree w(text);
-       
 
-        elapsedSecs = 0;
-        for(uint64_t i = 0; i < queryCount; ++i)
-        {
-            char queryChar = std::uniform_int_distribution<uint64_t>(1, 100)(rng);
-            if(!H[queryChar])
-                continue;
+void generate_bitvector(bit_vector &b, uint64_t len, double density, std::mt19937_64 &rng)
+{
+    b.set_len(len);
 
-            uint64_t queryIdx = std::uniform_int_distribution<uint64_t>(1, H[queryChar])(rng);
+    if(density == 0.5)  // Whole random words.
+    {
+        for(uint64_t i = 0; i < b.word_count(); ++i)
+            b.set_word(i, rng());
 
-            std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
-            w.select(H[queryChar], queryIdx);
-            std::chrono::high_resolution_clock::time_point t_end = std::chrono::high_resolution_clock::now();
+        if(len % 64)
+            b.set_word(b.word_count() - 1, b.get_word(b.word_count() - 1) & ((1ULL << (len % 64)) - 1));
 
-            std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(t_end - t_start);
-            elapsedSecs += time_span.count();
-        }
+        return;
+    }
 
+    std::bernoulli_distribution bit(density);
+    for(uint64_t i = 0; i < len; ++i)
+        if(bit(rng))
+            b.set_bit(i);
+}
 
-        delete(s);
 
 
-        printf("%llu\t\t%lf\n", (unsigned long long)len, elapsedSecs);
-    }
+bool wanted(const bench_config &config, const char *prefix)
+{
+    for(auto p = config.benchmarks.begin(); p != config.benchmarks.end(); ++p)
+        if(!p -> compare(0, strlen(prefix), prefix))
+            return true;
+
+    return false;
 }
 
 
 
-void benchmark_wt_rank_fixed_len(uint8_t maxSigmaSize, const uint64_t fixedLen, uint64_t queryCount)
+void run_bitvector_benchmarks(const bench_config &config, uint64_t len, double density, std::mt19937_64 &rng)
 {
-    puts("Benchmarking of wavelet tree rank queries with fixed len (10M).\n");
-    printf("|Sigma|\t\tTime(s)\t\tOverhead\n==========\n");
+    bit_vector b;
+    generate_bitvector(b, len, density, rng);
 
-    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    double elapsedSecs;
-    
-    char *s = new char[fixedLen + 1];
+    rank_support r(&b);
+    rank_support_poppy rp(&b);
+    select_support s(&r);
+    rank_select_fast rsf(&b);
+    rank_select_compact rsc(&b);
 
-    for(uint8_t i = 2; i <= maxSigmaSize; ++i)
-    {
-        for(uint64_t j = 0; j < fixedLen; ++j)
-            while((s[j] = std::uniform_int_distribution<uint64_t>(1, i)(rng)) == '\n');
-        
-        s[fixedLen] = '\0';
+    rrr_vector rv;
+    if(wanted(config, "rrr_"))
+        rv.build(b);
 
+    ef_vector ef;
+    if(wanted(config, "ef_"))
+        ef.build(b);
 
-        std::string text(s);
-        wavelet_tree w(text);
+    dynamic_bit_vector dv;
+    if(wanted(config, "dbv_"))
+        dv.build(b);
 
+    uint64_t oneCount = (len ? r.rank1(len - 1) : 0);
+    uint64_t queryCount = config.queryCount;
 
-        elapsedSecs = 0;
-        for(uint64_t j = 0; j < queryCount; ++j)
-        {
-            uint64_t queryIdx = std::uniform_int_distribution<uint64_t>(0, fixedLen - 1)(rng);
 
-            std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
-            w.rank(queryIdx);
-            std::chrono::high_resolution_clock::time_point t_end = std::chrono::high_resolution_clock::now();
+    // Queries: random positions (and widths, for get_int), and random ranks of ones and zeroes.
+
+    std::vector<uint64_t> pos(queryCount), width(queryCount), rank1(queryCount), rank0(queryCount);
+
+    for(uint64_t i = 0; i < queryCount; ++i)
+    {
+        width[i] = std::uniform_int_distribution<uint64_t>(1, 64)(rng);
+        pos[i] = std::uniform_int_distribution<uint64_t>(0, len - 1)(rng);
+        rank1[i] = (oneCount ? std::uniform_int_distribution<uint64_t>(1, oneCount)(rng) : 0);
+        rank0[i] = (len > oneCount ? std::uniform_int_distribution<uint64_t>(1, len - oneCount)(rng) : 0);
+
+        if(pos[i] + width[i] > len)
+            pos[i] = len - std::min(width[i], len);
+    }
+
 
-            std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(t_end - t_start);
-            elapsedSecs += time_span.count();
+    for(auto p = config.benchmarks.begin(); p != config.benchmarks.end(); ++p)
+    {
+        const std::string &name = *p;
+        bench_row row = {name, len, 0, density, queryCount, 0, {0, -1, -1, -1, {}, -1, -1}};
+
+        if(name == "get_int")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return b.get_int(pos[i], width[i]); });
+        else if(name == "popcount")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { return b.popcount(0, len); });
+        else if(name == "rank")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return r.rank1(pos[i]); }),
+            row.bitsPerElem = double(r.overhead()) / len;
+        else if(name == "rank_poppy")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rp.rank1(pos[i]); }),
+            row.bitsPerElem = double(rp.overhead()) / len;
+        else if(name == "rank_fast")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rsf.rank1(pos[i]); }),
+            row.bitsPerElem = double(rsf.overhead()) / len;
+        else if(name == "rank_compact")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rsc.rank1(pos[i]); }),
+            row.bitsPerElem = double(rsc.overhead()) / len;
+        else if(name == "select1" && oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return s.select1(rank1[i]); }),
+            row.bitsPerElem = double(r.overhead() + s.overhead()) / len;
+        else if(name == "select0" && len > oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return s.select0(rank0[i]); }),
+            row.bitsPerElem = double(r.overhead() + s.overhead()) / len;
+        else if(name == "select1_fast" && oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rsf.select1(rank1[i]); }),
+            row.bitsPerElem = double(rsf.overhead()) / len;
+        else if(name == "select1_compact" && oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rsc.select1(rank1[i]); }),
+            row.bitsPerElem = double(rsc.overhead()) / len;
+        else if(name == "select0_fast" && len > oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rsf.select0(rank0[i]); }),
+            row.bitsPerElem = double(rsf.overhead()) / len;
+        else if(name == "select0_compact" && len > oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rsc.select0(rank0[i]); }),
+            row.bitsPerElem = double(rsc.overhead()) / len;
+        else if(name == "rank_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { rank_support x(&b); return x.overhead(); }),
+            row.bitsPerElem = double(r.overhead()) / len;
+        else if(name == "rank_poppy_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { rank_support_poppy x(&b); return x.overhead(); }),
+            row.bitsPerElem = double(rp.overhead()) / len;
+        else if(name == "rank_fast_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { rank_select_fast x(&b); return x.overhead(); }),
+            row.bitsPerElem = double(rsf.overhead()) / len;
+        else if(name == "rank_compact_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { rank_select_compact x(&b); return x.overhead(); }),
+            row.bitsPerElem = double(rsc.overhead()) / len;
+        else if(name == "select_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { select_support x(&r); return x.overhead(); }),
+            row.bitsPerElem = double(r.overhead() + s.overhead()) / len;
+        else if(name == "rrr_access")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rv.get_bit(pos[i]); }),
+            row.bitsPerElem = double(rv.size_in_bits()) / len;
+        else if(name == "rrr_rank")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rv.rank1(pos[i]); }),
+            row.bitsPerElem = double(rv.size_in_bits()) / len;
+        else if(name == "rrr_select1" && oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rv.select1(rank1[i]); }),
+            row.bitsPerElem = double(rv.size_in_bits()) / len;
+        else if(name == "rrr_select0" && len > oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return rv.select0(rank0[i]); }),
+            row.bitsPerElem = double(rv.size_in_bits()) / len;
+        else if(name == "rrr_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { rrr_vector x; x.build(b); return x.size_in_bits(); }),
+            row.bitsPerElem = double(rv.size_in_bits()) / len;
+        else if(name == "ef_rank")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return ef.rank1(pos[i]); }),
+            row.bitsPerElem = double(ef.size_in_bits()) / len;
+        else if(name == "ef_select1" && oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return ef.select1(rank1[i]); }),
+            row.bitsPerElem = double(ef.size_in_bits()) / len;
+        else if(name == "ef_pred")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return ef.predecessor(pos[i]); }),
+            row.bitsPerElem = double(ef.size_in_bits()) / len;
+        else if(name == "ef_succ")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return ef.successor(pos[i]); }),
+            row.bitsPerElem = double(ef.size_in_bits()) / len;
+        else if(name == "ef_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { ef_vector x; x.build(b); return x.size_in_bits(); }),
+            row.bitsPerElem = double(ef.size_in_bits()) / len;
+        else if(name == "dbv_access")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return dv.get_bit(pos[i]); }),
+            row.bitsPerElem = double(dv.size_in_bits()) / len;
+        else if(name == "dbv_rank")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return dv.rank1(pos[i]); }),
+            row.bitsPerElem = double(dv.size_in_bits()) / len;
+        else if(name == "dbv_select1" && oneCount)
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return dv.select1(rank1[i]); }),
+            row.bitsPerElem = double(dv.size_in_bits()) / len;
+        else if(name == "dbv_update")
+        {
+            // An insertion and a deletion at random positions per query; the length stays len.
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { dv.insert(pos[i], width[i] & 1); dv.erase(pos[queryCount - 1 - i]); return dv.get_len(); });
+            row.bitsPerElem = double(dv.size_in_bits()) / len;
         }
+        else if(name == "dbv_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { dynamic_bit_vector x; x.build(b); return x.size_in_bits(); }),
+            row.bitsPerElem = double(dv.size_in_bits()) / len;
+        else
+            continue;
+
+        print_row(row, config.json);
+    }
+}
+
 
-        printf("%u\t\t%lf\n", (unsigned)i, elapsedSecs);
-    }   
+
+// A uniformly random text over sigma symbols: characters, or 32-bit integers for sigma > 256.
+template<typename T_text>
+void generate_text(T_text &text, uint64_t len, uint64_t sigma, std::mt19937_64 &rng)
+{
+    text.resize(len);
+
+    for(uint64_t i = 0; i < len; ++i)
+        text[i] = std::uniform_int_distribution<uint64_t>(0, sigma - 1)(rng);
 }
 
 
 
-void benchmark_wt_select_fixed_len(uint8_t maxSigmaSize, const uint64_t fixedLen, uint64_t queryCount)
+template<typename T_text>
+void run_text_benchmarks(const bench_config &config, T_text &text, uint64_t sigma, std::mt19937_64 &rng)
 {
-    puts("Benchmarking of wavelet tree select queries with fixed len (10M).\n");
-    printf("|Sigma|\t\tTime(s)\t\tOverhead\n==========\n");
+    // The symbol codes follow the alphabet mapping of the wavelet tree (matrix), i.e. the
+    // order of the distinct symbols.
+
+    uint64_t len = text.size();
 
-    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    double elapsedSecs;
-    uint64_t H[256];
-    
-    char *s = new char[fixedLen + 1];
+    alphabet_map alphabet;
+    alphabet.build(text);
 
-    for(uint8_t i = 2; i <= maxSigmaSize; ++i)
+    std::vector<uint64_t> count(alphabet.size(), 0);
+    for(uint64_t i = 0; i < len; ++i)
+        count[alphabet.code(symbol_at(text, i))]++;
+
+
+    // Queries: random positions, (code, position) pairs, and (code, occurrence) pairs.
+
+    uint64_t queryCount = config.queryCount;
+    std::vector<uint64_t> indices(queryCount);
+    std::vector<std::pair<uint32_t, uint64_t>> rankQ(queryCount), selectQ(queryCount);
+
+    for(uint64_t i = 0; i < queryCount; ++i)
     {
-        std::map<char, uint8_t> charMap;
+        indices[i] = std::uniform_int_distribution<uint64_t>(0, len - 1)(rng);
 
-        memset(H, 0, sizeof H);
+        uint32_t ch = alphabet.code(symbol_at(text, std::uniform_int_distribution<uint64_t>(0, len - 1)(rng)));
+        rankQ[i] = std::make_pair(ch, std::uniform_int_distribution<uint64_t>(0, len - 1)(rng));
+        selectQ[i] = std::make_pair(ch, std::uniform_int_distribution<uint64_t>(1, count[ch])(rng));
+    }
 
-        for(uint64_t j = 0; j < fixedLen; ++j)
-        {
-            while((s[j] = std::uniform_int_distribution<uint64_t>(1, i)(rng)) == '\n');
-            H[s[j]]++;
 
-            if(charMap.find(s[j]) == charMap.end())
-                charMap[s[j]] = 0;
-        }
+    std::unique_ptr<wavelet_tree> wt(wanted(config, "wt_") ? new wavelet_tree(text) : NULL);
+    std::unique_ptr<wavelet_matrix> wm(wanted(config, "wm_") ? new wavelet_matrix(text) : NULL);
+    std::unique_ptr<wavelet_tree> wtr(wanted(config, "wtr_") ? new wavelet_tree(text, 1, true) : NULL);
 
-        uint8_t distinct = 0;
-        for(auto p = charMap.begin(); p != charMap.end(); ++p)
-            p -> second = distinct++;
-        
-        s[fixedLen] = '\0';
+    for(auto p = config.benchmarks.begin(); p != config.benchmarks.end(); ++p)
+    {
+        const std::string &name = *p;
+        bench_row row = {name, len, sigma, -1, queryCount, 0, {0, -1, -1, -1, {}, -1, -1}};
+
+        if(!name.compare(0, 3, "wt_"))
+            row.bitsPerElem = double(wt -> size_in_bits()) / len;
+        else if(!name.compare(0, 3, "wm_"))
+            row.bitsPerElem = double(wm -> size_in_bits()) / len;
+        else if(!name.compare(0, 4, "wtr_"))
+            row.bitsPerElem = double(wtr -> size_in_bits()) / len;
+
+        std::vector<uint32_t> chResult;
+        std::vector<uint64_t> result;
+
+        if(name == "wt_access")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wt -> access(indices[i]); });
+        else if(name == "wt_rank")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wt -> rank(rankQ[i].first, rankQ[i].second); });
+        else if(name == "wt_select")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wt -> select(selectQ[i].first, selectQ[i].second); });
+        else if(name == "wt_access_batch")
+            row.m = measure_whole(queryCount, config.repeat, [&]() { wt -> access(indices, chResult); return chResult[0]; });
+        else if(name == "wt_rank_batch")
+            row.m = measure_whole(queryCount, config.repeat, [&]() { wt -> rank(rankQ, result); return result[0]; });
+        else if(name == "wt_select_batch")
+            row.m = measure_whole(queryCount, config.repeat, [&]() { wt -> select(selectQ, result); return result[0]; });
+        else if(name == "wt_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { wavelet_tree x(text); return x.size_in_bits(); });
+        else if(name == "wtr_access")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wtr -> access(indices[i]); });
+        else if(name == "wtr_rank")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wtr -> rank(rankQ[i].first, rankQ[i].second); });
+        else if(name == "wtr_select")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wtr -> select(selectQ[i].first, selectQ[i].second); });
+        else if(name == "wtr_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { wavelet_tree x(text, 1, true); return x.size_in_bits(); });
+        else if(name == "wm_access")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wm -> access(indices[i]); });
+        else if(name == "wm_rank")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wm -> rank(rankQ[i].first, rankQ[i].second); });
+        else if(name == "wm_select")
+            row.m = measure(queryCount, config.repeat, [&](uint64_t i) { return wm -> select(selectQ[i].first, selectQ[i].second); });
+        else if(name == "wm_access_batch")
+            row.m = measure_whole(queryCount, config.repeat, [&]() { wm -> access(indices, chResult); return chResult[0]; });
+        else if(name == "wm_rank_batch")
+            row.m = measure_whole(queryCount, config.repeat, [&]() { wm -> rank(rankQ, result); return result[0]; });
+        else if(name == "wm_select_batch")
+            row.m = measure_whole(queryCount, config.repeat, [&]() { wm -> select(selectQ, result); return result[0]; });
+        else if(name == "wm_build")
+            row.queryCount = 0,
+            row.m = measure_whole(len, config.repeat, [&]() { wavelet_matrix x(text); return x.size_in_bits(); });
+        else
+            continue;
+
+        print_row(row, config.json);
+    }
+}
 
 
-        std::string text(s);
-        wavelet_tree w(text);
 
+// Parses a comma-separated list of values, or a range "<first>:<last>:<step>"; where the step is
+// either additive, or multiplicative if prefixed with 'x'. E.g. "1e6,5e6" or "1e6:1e8:x10".
+std::vector<double> parse_values(const char *arg)
+{
+    std::vector<double> values;
+    std::string s(arg);
 
-        elapsedSecs = 0;
-        for(uint64_t j = 0; j < queryCount; ++j)
-        {
-            char queryChar = std::uniform_int_distribution<uint64_t>(1, i)(rng);
-            if(!H[queryChar])
-                continue;
+    if(std::count(s.begin(), s.end(), ':') == 2)
+    {
+        size_t c1 = s.find(':'), c2 = s.find(':', c1 + 1);
+        double first = atof(s.substr(0, c1).c_str()), last = atof(s.substr(c1 + 1, c2 - c1 - 1).c_str());
+        bool geometric = (s[c2 + 1] == 'x');
+        double step = atof(s.substr(c2 + 1 + geometric).c_str());
 
-            uint64_t queryIdx = std::uniform_int_distribution<uint64_t>(1, H[queryChar])(rng);
+        if(step <= (geometric ? 1 : 0))
+            return values;
 
-            std::chrono::high_resolution_clock::time_point t_start = std::chrono::high_resolution_clock::now();
-            w.select(H[queryChar], queryIdx);
-            std::chrono::high_resolution_clock::time_point t_end = std::chrono::high_resolution_clock::now();
+        for(double v = first; v <= last * (1 + 1e-9); v = (geometric ? v * step : v + step))
+            values.push_back(v);
 
-            std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(t_end - t_start);
-            elapsedSecs += time_span.count();
-        }
+        return values;
+    }
+
+    for(size_t start = 0, end; start <= s.size(); start = end + 1)
+    {
+        end = s.find(',', start);
+        if(end == std::string::npos)
+            end = s.size();
+
+        values.push_back(atof(s.substr(start, end - start).c_str()));
+    }
+
+    return values;
+}
 
 
-        printf("%u\t\t%lf\n", (unsigned)i, elapsedSecs);
-    }   
+
+void usage()
+{
+    puts("Usage: benchmark [options]\n"
+        "  --bench <names>      comma-separated benchmarks (default: rank), or \"all\"; among\n"
+        "                       get_int, popcount, rank, rank_poppy, select1, select0,\n"
+        "                       rank_build, rank_poppy_build, select_build, rank_fast, rank_compact,\n"
+        "                       select1_fast, select1_compact, select0_fast, select0_compact,\n"
+        "                       rank_fast_build, rank_compact_build (fixed layouts), rrr_access, rrr_rank,\n"
+        "                       rrr_select1, rrr_select0, rrr_build (RRR-compressed bitvector),\n"
+        "                       ef_rank, ef_select1, ef_pred, ef_succ, ef_build (Elias-Fano),\n"
+        "                       dbv_access, dbv_rank, dbv_select1, dbv_update, dbv_build (dynamic),\n"
+        "                       wt_access, wt_rank, wt_select, wt_access_batch, wt_rank_batch,\n"
+        "                       wt_select_batch, wt_build, and the same for wm_ (wavelet matrix);\n"
+        "                       wtr_access, wtr_rank, wtr_select, wtr_build (RRR-compressed tree)\n"
+        "  --n <values>         bitvector / text lengths (default: 1e6)\n"
+        "  --sigma <values>     alphabet sizes of the texts; integer texts above 256 (default: 100)\n"
+        "  --density <values>   densities of ones in the bitvectors (default: 0.5)\n"
+        "  --queries <count>    queries per measurement (default: 1e6)\n"
+        "  --repeat <count>     measurements per benchmark; the median is reported (default: 3)\n"
+        "  --seed <value>       seed of the random inputs and queries (default: 42)\n"
+        "  --format csv|json    output format (default: csv)\n"
+        "  --perf               also report the hardware counts per query of the measured loops\n"
+        "                       (and node_ops, rank1_calls if built with -DWT_COUNT_OPS)\n"
+        "<values> is a comma-separated list, or a range <first>:<last>:<step>, with an 'x' prefixed\n"
+        "step for a geometric one; e.g. --n 1e6:1e8:x10.");
 }
 
 
 
 int main(int argc, char *argv[])
 {
-    uint64_t startLen = 101000000;    // 1M
-    uint64_t endLen = 200000000;    // 100M
-    uint64_t stepSize = 1000000;    // 1M
-    uint64_t queryCount = 1000000;  // 1M
-    
-    
-    // benchmark_rank(startLen, endLen, stepSize, queryCount);
+    const char *all[] = {"get_int", "popcount", "rank", "rank_poppy", "select1", "select0", "rank_build", "rank_poppy_build",
+                        "select_build", "rank_fast", "rank_compact", "select1_fast", "select1_compact", "select0_fast",
+                        "select0_compact", "rank_fast_build", "rank_compact_build", "rrr_access", "rrr_rank", "rrr_select1", "rrr_select0", "rrr_build", "ef_rank", "ef_select1",
+                        "ef_pred", "ef_succ", "ef_build", "dbv_access", "dbv_rank", "dbv_select1",
+                        "dbv_update", "dbv_build", "wt_access", "wt_rank", "wt_select", "wt_access_batch", "wt_rank_batch",
+                        "wt_select_batch", "wt_build", "wtr_access", "wtr_rank", "wtr_select", "wtr_build", "wm_access", "wm_rank", "wm_select", "wm_access_batch",
+                        "wm_rank_batch", "wm_select_batch", "wm_build"};
+
+    bench_config config;
+    config.benchmarks.push_back("rank");
+    config.n.push_back(1e6);
+    config.sigma.push_back(100);
+    config.density.push_back(0.5);
+    config.queryCount = 1000000;
+    config.repeat = 3;
+    config.seed = 42;
+    config.json = false;
+
+
+    for(int i = 1; i < argc; ++i)
+    {
+        const char *opt = argv[i], *val = (i + 1 < argc ? argv[i + 1] : NULL);
 
-    // benchmark_select(startLen, endLen, stepSize, queryCount);
+        if(!strcmp(opt, "--help") || !strcmp(opt, "-h"))
+        {
+            usage();
+            return 0;
+        }
 
-    // benchmark_wt_rank_fixed_alphabet(startLen, endLen, stepSize, queryCount);
+        if(!strcmp(opt, "--perf"))
+        {
+            profile = true;
+            continue;
+        }
 
-    // benchmark_wt_select_fixed_alphabet(startLen, endLen, stepSize, queryCount);
+        if(!val)
+        {
+            usage();
+            return 1;
+        }
 
+        i++;
 
-    uint8_t maxSigmaSize = 128;     
-    uint64_t fixedSize = 10000000; // 10M
+        if(!strcmp(opt, "--bench"))
+        {
+            config.benchmarks.clear();
+
+            if(!strcmp(val, "all"))
+                config.benchmarks.assign(all, all + sizeof(all) / sizeof(all[0]));
+            else
+                for(const char *p = val; *p; )
+                {
+                    const char *q = strchr(p, ',');
+                    config.benchmarks.push_back(q ? std::string(p, q) : std::string(p));
+                    p = (q ? q + 1 : p + strlen(p));
+                }
+        }
+        else if(!strcmp(opt, "--n"))
+            config.n = parse_values(val);
+        else if(!strcmp(opt, "--sigma"))
+            config.sigma = parse_values(val);
+        else if(!strcmp(opt, "--density"))
+            config.density = parse_values(val);
+        else if(!strcmp(opt, "--queries"))
+            config.queryCount = atof(val);
+        else if(!strcmp(opt, "--repeat"))
+            config.repeat = std::max(1, atoi(val));
+        else if(!strcmp(opt, "--seed"))
+            config.seed = strtoull(val, NULL, 10);
+        else if(!strcmp(opt, "--format"))
+            config.json = !strcmp(val, "json");
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    for(auto p = config.benchmarks.begin(); p != config.benchmarks.end(); ++p)
+        if(std::find(all, all + sizeof(all) / sizeof(all[0]), *p) == all + sizeof(all) / sizeof(all[0]))
+        {
+            fprintf(stderr, "Unknown benchmark %s.\n", p -> c_str());
+            return 1;
+        }
+
+    if(!config.queryCount)
+        config.queryCount = 1;
 
-    // benchmark_wt_rank_fixed_len(maxSigmaSize, fixedSize, queryCount);
 
-    benchmark_wt_select_fixed_len(maxSigmaSize, fixedSize, queryCount);
+    std::mt19937_64 rng(config.seed);
+    bool bitvectorBench = wanted(config, "get_int") || wanted(config, "popcount") || wanted(config, "rank") || wanted(config, "select")
+                            || wanted(config, "rrr_") || wanted(config, "ef_") || wanted(config, "dbv_");
+    bool textBench = wanted(config, "wt_") || wanted(config, "wm_") || wanted(config, "wtr_");
+
+    print_header(config.json);
+
+    for(auto n = config.n.begin(); n != config.n.end(); ++n)
+    {
+        uint64_t len = std::max<uint64_t>(1, *n);
+
+        if(bitvectorBench)
+            for(auto d = config.density.begin(); d != config.density.end(); ++d)
+                run_bitvector_benchmarks(config, len, std::min(1.0, std::max(0.0, *d)), rng);
+
+        if(textBench)
+            for(auto p = config.sigma.begin(); p != config.sigma.end(); ++p)
+            {
+                uint64_t sigma = std::min<uint64_t>(1ULL << 32, std::max<uint64_t>(1, *p));
+
+                if(sigma <= 256)
+                {
+                    std::string text;
+                    generate_text(text, len, sigma, rng);
+                    run_text_benchmarks(config, text, sigma, rng);
+                }
+                else
+                {
+                    std::vector<uint32_t> text;
+                    generate_text(text, len, sigma, rng);
+                    run_text_benchmarks(config, text, sigma, rng);
+                }
+            }
+    }
+
+    print_footer(config.json);
+
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,46 +1,93 @@
+#ifndef BIT_VECTOR_H
+#define BIT_VECTOR_H
+
 #include<cstdint>
 #include<cstdio>
 #include<fstream>
 #include<random>
 #include<functional>
+#include<algorithm>
+
+#include "mmap_reader.h"
+#include "popcount.h"
+
+#ifdef __BMI2__
+#include<immintrin.h>
+#endif
 
 
 class bit_vector
 {
 private:
-    const static int UNIT_WIDTH = 8;
-    const static uint64_t ALL_ONES_UNIT = 0xFF;
+    // The bits are stored in 64-bit words, so that any field of width up to 64 bits
+    // spans at most two consecutive words. The in-memory layout is little-endian, hence
+    // the byte-level (serialized) representation is identical to a byte-packed one.
+    const static int UNIT_WIDTH = 64;
+    const static int UNIT_SHIFT = 6;
+    const static uint64_t UNIT_MASK = UNIT_WIDTH - 1;
 
     uint64_t len;
-    unsigned char *B;
+    uint64_t *B;
+    uint64_t cap;   // Number of words allocated for B; may exceed the words in use after a resize.
+    bool mapped;    // Whether B is a view into a memory-mapped file, rather than owned.
+
+
+    inline static uint64_t unit_count(uint64_t len) { return (len + UNIT_WIDTH - 1) / UNIT_WIDTH; }
+    inline static uint64_t low_mask(uint64_t len) { return len < UNIT_WIDTH ? (1ULL << len) - 1 : ~0ULL; }
 
 public:
-    bit_vector() { len = 0; }
+    bit_vector() { len = 0, B = NULL, cap = 0, mapped = false; }
     bit_vector(uint64_t len);
     bit_vector(bool *bits, uint64_t len);
     
-    ~bit_vector() { delete B; }
+    ~bit_vector() { if(!mapped) delete[] B; }
 
 
     inline uint64_t get_len() { return len; }
+    inline uint64_t word_count() { return unit_count(len); }
+    inline uint64_t get_word(uint64_t wrdIdx) { return B[wrdIdx]; }
+    inline void set_word(uint64_t wrdIdx, uint64_t val) { B[wrdIdx] = val; }
     inline void set_len(uint64_t len);
+    void resize(uint64_t len);
     inline bool get_bit(uint64_t idx);
     inline void set_bit(uint64_t idx);
     inline void reset_bit(uint64_t idx);
+    inline void prefetch(uint64_t idx) { __builtin_prefetch(B + (idx >> UNIT_SHIFT)); }
     uint64_t get_int(uint64_t idx, uint64_t len);
     void set_int(uint64_t idx, uint64_t len, uint64_t val);
+    void or_int_atomic(uint64_t idx, uint64_t len, uint64_t val);
+    uint64_t popcount(uint64_t start, uint64_t end);
     void print();
     void serialize(std::ofstream &output);
     void deserialize(std::ifstream &input);
+    void deserialize(mmap_reader &input);
     void generate_random_bitvector(uint64_t length);
 };
 
 
 
+// Returns the position of the (k + 1)'th set bit in the 64-bit word; the word must
+// contain at least (k + 1) set bits.
+inline uint64_t select_in_word(uint64_t word, uint64_t k)
+{
+#ifdef __BMI2__
+    return __builtin_ctzll(_pdep_u64(1ULL << k, word));
+#else
+    for(; k; --k)
+        word &= word - 1;
+
+    return __builtin_ctzll(word);
+#endif
+}
+
+
+
 bit_vector::bit_vector(uint64_t len)
 {
     this -> len = len;
-    B = new unsigned char[(len + UNIT_WIDTH - 1) / UNIT_WIDTH]();
+    B = new uint64_t[unit_count(len)]();
+    cap = unit_count(len);
+    mapped = false;
 }
 
 
@@ -48,7 +95,9 @@ bit_vector::bit_vector(uint64_t len)
 bit_vector::bit_vector(bool *bits, uint64_t len)
 {
     this -> len = len;
-    B = new unsigned char[(len + UNIT_WIDTH - 1) / UNIT_WIDTH];
+    B = new uint64_t[unit_count(len)]();
+    cap = unit_count(len);
+    mapped = false;
 
     for(uint64_t i = 0; i < len; ++i)
         bits[i] ? set_bit(i) : reset_bit(i);
@@ -58,86 +107,143 @@ bit_vector::bit_vector(bool *bits, uint64_t len)
 
 void bit_vector::set_len(uint64_t len)
 {
-    if(this -> len)
-        delete B;
+    if(!mapped)
+        delete[] B;
+
+    this -> len = len;
+    B = new uint64_t[unit_count(len)]();
+    cap = unit_count(len);
+    mapped = false;
+}
+
+
+
+void bit_vector::resize(uint64_t len)
+{
+    // Keeps the first bits, and zeroes the bits past the old length. The storage grows to twice
+    // the words required, so that a sequence of growing resizes copies each bit O(1) times
+    // amortized; a view of a mapped file is copied out into owned storage at first.
+
+    uint64_t wrdCnt = unit_count(len), oldWrdCnt = unit_count(this -> len);
+
+    if(mapped || wrdCnt > cap)
+    {
+        uint64_t *words = new uint64_t[2 * wrdCnt]();
+        std::copy(B, B + std::min(wrdCnt, oldWrdCnt), words);
+
+        if(!mapped)
+            delete[] B;
+
+        B = words, cap = 2 * wrdCnt;
+        mapped = false;
+    }
+    else if(wrdCnt < oldWrdCnt)
+        std::fill(B + wrdCnt, B + oldWrdCnt, 0);
+
+    // The bits past the length are kept zero; select and popcount read the last word whole.
+    if(len < this -> len && (len & UNIT_MASK))
+        B[wrdCnt - 1] &= low_mask(len & UNIT_MASK);
 
     this -> len = len;
-    B = new unsigned char[(len + UNIT_WIDTH - 1) / UNIT_WIDTH]();
 }
 
 
 
 bool bit_vector::get_bit(uint64_t idx)
 {
-    return (B[idx / UNIT_WIDTH]) & (1u << (idx % UNIT_WIDTH));
+    return (B[idx >> UNIT_SHIFT] >> (idx & UNIT_MASK)) & 1;
 }
 
 
 
 void bit_vector::set_bit(uint64_t idx)
 {
-    B[idx / UNIT_WIDTH] |= (1u << (idx % UNIT_WIDTH));
+    B[idx >> UNIT_SHIFT] |= (1ULL << (idx & UNIT_MASK));
 }
 
 
 
 void bit_vector::reset_bit(uint64_t idx)
 {
-    B[idx / UNIT_WIDTH] &= ~(1u << (idx % UNIT_WIDTH));
+    B[idx >> UNIT_SHIFT] &= ~(1ULL << (idx & UNIT_MASK));
 }
 
 
 
 void bit_vector::set_int(uint64_t idx, uint64_t len, uint64_t val)
 {
-    while(len && idx % UNIT_WIDTH)
-    {
-        (val & 1) ? set_bit(idx) : reset_bit(idx);
-        idx++, len--, val >>= 1;
-    }
+    // The field [idx, idx + len) occupies the high end of the word at idx, and possibly
+    // spills over to the low end of the next word; 1 <= len <= 64.
 
-    while(len >= UNIT_WIDTH)
-    {
-        B[idx / UNIT_WIDTH] = (val & ALL_ONES_UNIT);
-        idx += UNIT_WIDTH, len -= UNIT_WIDTH, val >>= UNIT_WIDTH;
-    }
+    if(!len)
+        return;
+
+    uint64_t wrd = idx >> UNIT_SHIFT, offset = idx & UNIT_MASK;
+    uint64_t mask = low_mask(len);
 
-    while(len)
+    val &= mask;
+    B[wrd] = (B[wrd] & ~(mask << offset)) | (val << offset);
+
+    if(offset + len > UNIT_WIDTH)
     {
-        (val & 1) ? set_bit(idx) : reset_bit(idx);
-        idx++, len--, val >>= 1;
+        uint64_t shift = UNIT_WIDTH - offset;
+        B[wrd + 1] = (B[wrd + 1] & ~(mask >> shift)) | (val >> shift);
     }
 }
 
 
 
+void bit_vector::or_int_atomic(uint64_t idx, uint64_t len, uint64_t val)
+{
+    // Same as set_int for a zeroed field, but with atomic word updates; so that concurrent
+    // writers of disjoint fields sharing a word do not race.
+
+    if(!len)
+        return;
+
+    uint64_t wrd = idx >> UNIT_SHIFT, offset = idx & UNIT_MASK;
+
+    val &= low_mask(len);
+    __atomic_fetch_or(&B[wrd], val << offset, __ATOMIC_RELAXED);
+
+    if(offset + len > UNIT_WIDTH)
+        __atomic_fetch_or(&B[wrd + 1], val >> (UNIT_WIDTH - offset), __ATOMIC_RELAXED);
+}
+
+
+
 uint64_t bit_vector::get_int(uint64_t idx, uint64_t len)
 {
-    uint64_t val = 0, i = 0;
+    if(!len)
+        return 0;
 
-    while(i < len && idx % UNIT_WIDTH)
-    {
-        if(get_bit(idx))
-            val |= (1 << i);
+    uint64_t wrd = idx >> UNIT_SHIFT, offset = idx & UNIT_MASK;
+    uint64_t val = B[wrd] >> offset;
 
-        idx++, i++;
-    }
+    if(offset + len > UNIT_WIDTH)
+        val |= B[wrd + 1] << (UNIT_WIDTH - offset);
 
-    while((len - i) >= UNIT_WIDTH)
-    {
-        val |= (B[idx / UNIT_WIDTH] << i);
-        idx += UNIT_WIDTH, i += UNIT_WIDTH;
-    }
+    return val & low_mask(len);
+}
 
-    while(i < len)
-    {
-        if(get_bit(idx))
-            val |= (1 << i);
 
-        idx++, i++;
-    }
 
-    return val;
+uint64_t bit_vector::popcount(uint64_t start, uint64_t end)
+{
+    // Returns the number of ones in [start, end); the whole words in between are counted
+    // with the bulk popcount kernel.
+
+    if(start >= end)
+        return 0;
+
+    uint64_t first = start >> UNIT_SHIFT, last = (end - 1) >> UNIT_SHIFT;
+
+    if(first == last)
+        return __builtin_popcountll((B[first] >> (start & UNIT_MASK)) & low_mask(end - start));
+
+    return __builtin_popcountll(B[first] >> (start & UNIT_MASK)) +
+            popcount_words(B + first + 1, last - first - 1) +
+            __builtin_popcountll(B[last] & low_mask(((end - 1) & UNIT_MASK) + 1));
 }
 
 
@@ -163,11 +269,15 @@ void bit_vector::print()
 
 void bit_vector::serialize(std::ofstream &output)
 {
+    // The words are written whole, at an 8-byte aligned offset of the file; so that a
+    // memory-mapped file can be viewed in place (see deserialize(mmap_reader &)).
+
     output.write((const char *)&len, sizeof(len));
-    
-    uint64_t slots = (len + UNIT_WIDTH - 1) / UNIT_WIDTH;
 
-    output.write((const char *)B, slots);
+    const char pad[8] = {0};
+    output.write(pad, (8 - (uint64_t)output.tellp() % 8) % 8);
+
+    output.write((const char *)B, unit_count(len) * sizeof(uint64_t));
 }
 
 
@@ -178,24 +288,42 @@ void bit_vector::deserialize(std::ifstream &input)
     input.read((char *)&l, sizeof(l));
     
     set_len(l);
+
+    input.seekg((8 - (uint64_t)input.tellg() % 8) % 8, std::ios::cur);
     
-    uint64_t slots = (len + UNIT_WIDTH - 1) / UNIT_WIDTH;
+    input.read((char *)B, unit_count(len) * sizeof(uint64_t));
+}
+
 
-    input.read((char *)B, slots);
+
+void bit_vector::deserialize(mmap_reader &input)
+{
+    // No copy; the bitvector is read-only hereafter, and valid as long as the mapping.
+
+    uint64_t l;
+    input.read((char *)&l, sizeof(l));
+
+    if(!mapped)
+        delete[] B;
+
+    len = l;
+    B = (uint64_t *)input.view_words(unit_count(len));
+    cap = unit_count(len);
+    mapped = true;
 }
 
 
 
 void bit_vector::generate_random_bitvector(uint64_t length)
 {
-    if(this -> len)
-        delete B;
-
-    this -> len = length;
-    B = new unsigned char[(len + UNIT_WIDTH - 1) / UNIT_WIDTH]();
+    set_len(length);
 
     
     auto gen = std::bind(std::uniform_int_distribution<>(0,1), std::default_random_engine());
     for(uint64_t idx = 0; idx < len; ++idx)
         gen() ? set_bit(idx) : reset_bit(idx);
-}
\ No newline at end of file
+}
+
+
+
+#endif
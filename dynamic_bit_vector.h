@@ -0,0 +1,660 @@
+#ifndef DYNAMIC_BIT_VECTOR_H
+#define DYNAMIC_BIT_VECTOR_H
+
+#include<cstdint>
+#include<cstring>
+#include<limits>
+#include<vector>
+#include<algorithm>
+
+#include "bit_vector.h"
+
+
+// Dynamic bitvector, with insertions and deletions of bits as well as rank and select, all in
+// O(log n) time: a B+-tree whose leaves hold up to LEAF_BITS consecutive bits in a few cache
+// lines, and whose internal nodes hold the number of bits and of ones in the subtree of each of
+// their (up to FANOUT) children. A query descends from the root, skipping the children wholly
+// before its position (or rank); and an update descends the same way, fixing the counts along
+// the path. A full leaf or node is split in two; and one less than a quarter full is merged
+// with a neighbour, or evened out with it if the two do not fit in three quarters of one. All
+// the leaves are at the same depth; and every leaf and node, but the root, is at least a
+// quarter full.
+
+class dynamic_bit_vector
+{
+private:
+    const static uint64_t LEAF_WORDS = 16;                  // Words per leaf.
+    const static uint64_t LEAF_BITS = LEAF_WORDS * 64;      // Max number of bits per leaf.
+    const static uint64_t FANOUT = 16;                      // Max number of children per node.
+
+    struct leaf
+    {
+        uint64_t bits[LEAF_WORDS];  // The bits past the leaf's length are kept zero.
+    };
+
+    struct node
+    {
+        uint64_t size[FANOUT + 1];  // Number of bits under each child; one extra entry, for an
+        uint64_t ones[FANOUT + 1];  // overflow until the node is split.
+        void *child[FANOUT + 1];    // Children; the leaves, at the lowest level.
+        uint8_t count;              // Number of children.
+    };
+
+    uint64_t len;       // Number of bits.
+    uint64_t oneCount;  // Number of ones.
+    node *root;         // Root; never a leaf, and with at least one child.
+    uint8_t height;     // Number of levels of nodes; the children of the level 1 nodes are leaves.
+    uint64_t leafCnt;   // Number of leaves.
+    uint64_t nodeCnt;   // Number of nodes.
+
+    dynamic_bit_vector(const dynamic_bit_vector &);
+    dynamic_bit_vector &operator=(const dynamic_bit_vector &);
+
+
+    static uint64_t get_bits(const uint64_t *wrds, uint64_t idx, uint64_t count);
+    static void set_bits(uint64_t *wrds, uint64_t idx, uint64_t count, uint64_t val);
+    static void copy_bits(uint64_t *dst, uint64_t dstIdx, const uint64_t *src, uint64_t srcIdx, uint64_t count);
+    static uint64_t ones_in(const uint64_t *wrds, uint64_t count);
+
+    leaf *new_leaf() { leafCnt++; return new leaf(); }
+    node *new_node() { nodeCnt++; return new node(); }
+    void free_subtree(void *v, uint8_t level);
+    void insert_child(node *n, uint8_t j, void *child, uint64_t size, uint64_t ones);
+    void remove_child(node *n, uint8_t j);
+    void sum_child(node *n, uint8_t j);
+    void split_leaf(node *n, uint8_t j);
+    node *split_node(node *n);
+    void rebalance(node *n, uint8_t j, uint8_t level);
+    node *insert(node *n, uint8_t level, uint64_t idx, bool bit);
+    bool erase(node *n, uint8_t level, uint64_t idx);
+    uint64_t ones_before(uint64_t idx);
+    uint64_t select(uint64_t rank, bool bit);
+
+
+public:
+    dynamic_bit_vector();
+    ~dynamic_bit_vector() { free_subtree(root, height); }
+
+    void build(bit_vector &B);
+    uint64_t get_len() { return len; }
+    uint64_t one_count() { return oneCount; }
+    bool get_bit(uint64_t idx);
+    void set(uint64_t idx, bool bit);
+    void insert(uint64_t idx, bool bit);
+    void erase(uint64_t idx);
+    uint64_t rank1(uint64_t idx) { return ones_before(idx + 1); }
+    uint64_t rank0(uint64_t idx) { return idx + 1 - ones_before(idx + 1); }
+    uint64_t select1(uint64_t rank) { return select(rank, 1); }
+    uint64_t select0(uint64_t rank) { return select(rank, 0); }
+    uint64_t size_in_bits() { return (leafCnt * sizeof(leaf) + nodeCnt * sizeof(node)) * 8; }
+};
+
+
+
+dynamic_bit_vector::dynamic_bit_vector()
+{
+    len = oneCount = 0;
+    leafCnt = nodeCnt = 0;
+    height = 1;
+
+    root = new_node();
+    insert_child(root, 0, new_leaf(), 0, 0);
+}
+
+
+
+uint64_t dynamic_bit_vector::get_bits(const uint64_t *wrds, uint64_t idx, uint64_t count)
+{
+    // Returns the count (1 to 64) bits from idx on.
+
+    uint64_t wrd = idx >> 6, offset = idx & 63;
+    uint64_t val = wrds[wrd] >> offset;
+
+    if(offset + count > 64)
+        val |= wrds[wrd + 1] << (64 - offset);
+
+    return count < 64 ? val & ((1ULL << count) - 1) : val;
+}
+
+
+
+void dynamic_bit_vector::set_bits(uint64_t *wrds, uint64_t idx, uint64_t count, uint64_t val)
+{
+    // Sets the count (1 to 64) bits from idx on to val.
+
+    uint64_t wrd = idx >> 6, offset = idx & 63;
+    uint64_t mask = (count < 64 ? (1ULL << count) - 1 : ~0ULL);
+
+    wrds[wrd] = (wrds[wrd] & ~(mask << offset)) | (val << offset);
+
+    if(offset + count > 64)
+        wrds[wrd + 1] = (wrds[wrd + 1] & ~(mask >> (64 - offset))) | (val >> (64 - offset));
+}
+
+
+
+void dynamic_bit_vector::copy_bits(uint64_t *dst, uint64_t dstIdx, const uint64_t *src, uint64_t srcIdx, uint64_t count)
+{
+    for(uint64_t done = 0; done < count; done += 64)
+    {
+        uint64_t chunk = std::min<uint64_t>(64, count - done);
+        set_bits(dst, dstIdx + done, chunk, get_bits(src, srcIdx + done, chunk));
+    }
+}
+
+
+
+uint64_t dynamic_bit_vector::ones_in(const uint64_t *wrds, uint64_t count)
+{
+    // Returns the number of ones among the first count bits.
+
+    uint64_t ones = 0;
+
+    for(uint64_t i = 0; i < count / 64; ++i)
+        ones += __builtin_popcountll(wrds[i]);
+
+    if(count & 63)
+        ones += __builtin_popcountll(wrds[count / 64] & ((1ULL << (count & 63)) - 1));
+
+    return ones;
+}
+
+
+
+void dynamic_bit_vector::free_subtree(void *v, uint8_t level)
+{
+    // Levels count up from the leaves, at level 0.
+
+    if(!level)
+    {
+        delete (leaf *)v;
+        leafCnt--;
+        return;
+    }
+
+    node *n = (node *)v;
+
+    for(uint8_t j = 0; j < n -> count; ++j)
+        free_subtree(n -> child[j], level - 1);
+
+    delete n;
+    nodeCnt--;
+}
+
+
+
+void dynamic_bit_vector::insert_child(node *n, uint8_t j, void *child, uint64_t size, uint64_t ones)
+{
+    for(uint8_t k = n -> count; k > j; --k)
+    {
+        n -> size[k] = n -> size[k - 1];
+        n -> ones[k] = n -> ones[k - 1];
+        n -> child[k] = n -> child[k - 1];
+    }
+
+    n -> size[j] = size, n -> ones[j] = ones, n -> child[j] = child;
+    n -> count++;
+}
+
+
+
+void dynamic_bit_vector::remove_child(node *n, uint8_t j)
+{
+    n -> count--;
+
+    for(uint8_t k = j; k < n -> count; ++k)
+    {
+        n -> size[k] = n -> size[k + 1];
+        n -> ones[k] = n -> ones[k + 1];
+        n -> child[k] = n -> child[k + 1];
+    }
+}
+
+
+
+void dynamic_bit_vector::sum_child(node *n, uint8_t j)
+{
+    // Recomputes the counts of the j'th child of n, a node, from its own counts.
+
+    node *c = (node *)n -> child[j];
+
+    n -> size[j] = n -> ones[j] = 0;
+
+    for(uint8_t k = 0; k < c -> count; ++k)
+        n -> size[j] += c -> size[k], n -> ones[j] += c -> ones[k];
+}
+
+
+
+void dynamic_bit_vector::split_leaf(node *n, uint8_t j)
+{
+    // Moves the upper half of the j'th child of n, a full leaf, to a new leaf after it.
+
+    leaf *l = (leaf *)n -> child[j], *r = new_leaf();
+    const uint64_t half = LEAF_WORDS / 2;
+
+    memcpy(r -> bits, l -> bits + half, half * sizeof(uint64_t));
+    memset(l -> bits + half, 0, half * sizeof(uint64_t));
+
+    uint64_t rOnes = ones_in(r -> bits, half * 64);
+
+    insert_child(n, j + 1, r, n -> size[j] - half * 64, rOnes);
+    n -> size[j] = half * 64, n -> ones[j] -= rOnes;
+}
+
+
+
+dynamic_bit_vector::node *dynamic_bit_vector::split_node(node *n)
+{
+    // Moves the upper half of the children of n to a new node, and returns it.
+
+    node *m = new_node();
+    uint8_t keep = n -> count / 2;
+
+    for(uint8_t k = keep; k < n -> count; ++k)
+        insert_child(m, m -> count, n -> child[k], n -> size[k], n -> ones[k]);
+
+    n -> count = keep;
+
+    return m;
+}
+
+
+
+void dynamic_bit_vector::rebalance(node *n, uint8_t j, uint8_t level)
+{
+    // The j'th child of n is less than a quarter full; merge it with a neighbour if the two fit
+    // in three quarters of one, or split their contents evenly otherwise.
+
+    uint8_t a = (j + 1 < n -> count ? j : j - 1), b = a + 1;
+
+    if(level == 1)
+    {
+        leaf *la = (leaf *)n -> child[a], *lb = (leaf *)n -> child[b];
+        uint64_t total = n -> size[a] + n -> size[b];
+        uint64_t buf[2 * LEAF_WORDS] = {0};
+
+        memcpy(buf, la -> bits, sizeof(la -> bits));
+        copy_bits(buf, n -> size[a], lb -> bits, 0, n -> size[b]);
+
+        uint64_t sizeA = (total <= LEAF_BITS * 3 / 4 ? total : total / 2);
+
+        memset(la -> bits, 0, sizeof(la -> bits));
+        memset(lb -> bits, 0, sizeof(lb -> bits));
+        copy_bits(la -> bits, 0, buf, 0, sizeA);
+        copy_bits(lb -> bits, 0, buf, sizeA, total - sizeA);
+
+        uint64_t onesA = ones_in(la -> bits, sizeA);
+
+        n -> ones[b] = n -> ones[a] + n -> ones[b] - onesA;
+        n -> size[b] = total - sizeA;
+        n -> ones[a] = onesA, n -> size[a] = sizeA;
+
+        if(sizeA == total)
+        {
+            delete lb;
+            leafCnt--;
+            remove_child(n, b);
+        }
+
+        return;
+    }
+
+
+    node *na = (node *)n -> child[a], *nb = (node *)n -> child[b];
+    uint8_t total = na -> count + nb -> count;
+    uint8_t countA = (total <= FANOUT * 3 / 4 ? total : total / 2);
+
+    if(na -> count < countA)
+        while(na -> count < countA)
+        {
+            insert_child(na, na -> count, nb -> child[0], nb -> size[0], nb -> ones[0]);
+            remove_child(nb, 0);
+        }
+    else
+        while(na -> count > countA)
+        {
+            uint8_t last = na -> count - 1;
+
+            insert_child(nb, 0, na -> child[last], na -> size[last], na -> ones[last]);
+            remove_child(na, last);
+        }
+
+    if(!nb -> count)
+    {
+        delete nb;
+        nodeCnt--;
+        remove_child(n, b);
+    }
+    else
+        sum_child(n, b);
+
+    sum_child(n, a);
+}
+
+
+
+dynamic_bit_vector::node *dynamic_bit_vector::insert(node *n, uint8_t level, uint64_t idx, bool bit)
+{
+    // Inserts the bit at idx of the subtree of n, at the given level; and returns the new right
+    // sibling of n, if n had to be split.
+
+    uint8_t j = 0;
+    while(j + 1 < n -> count && idx > n -> size[j])
+        idx -= n -> size[j++];
+
+    if(level == 1)
+    {
+        if(n -> size[j] == LEAF_BITS)
+        {
+            split_leaf(n, j);
+
+            if(idx > n -> size[j])
+                idx -= n -> size[j++];
+        }
+
+
+        // Shift the bits from idx on up by one, and put the bit in between.
+
+        uint64_t *wrds = ((leaf *)n -> child[j]) -> bits;
+        uint64_t wrdIdx = idx / 64, lowMask = (1ULL << (idx & 63)) - 1;
+
+        for(uint64_t k = n -> size[j] / 64; k > wrdIdx; --k)
+            wrds[k] = (wrds[k] << 1) | (wrds[k - 1] >> 63);
+
+        wrds[wrdIdx] = (wrds[wrdIdx] & lowMask) | ((wrds[wrdIdx] & ~lowMask) << 1) | ((uint64_t)bit << (idx & 63));
+
+        n -> size[j]++, n -> ones[j] += bit;
+    }
+    else
+    {
+        node *sibling = insert((node *)n -> child[j], level - 1, idx, bit);
+
+        if(sibling)
+        {
+            insert_child(n, j + 1, sibling, 0, 0);
+            sum_child(n, j + 1);
+            sum_child(n, j);
+        }
+        else
+            n -> size[j]++, n -> ones[j] += bit;
+    }
+
+    return n -> count > FANOUT ? split_node(n) : NULL;
+}
+
+
+
+bool dynamic_bit_vector::erase(node *n, uint8_t level, uint64_t idx)
+{
+    // Erases the bit at idx of the subtree of n, at the given level; and returns it.
+
+    uint8_t j = 0;
+    while(idx >= n -> size[j])
+        idx -= n -> size[j++];
+
+    bool bit;
+
+    if(level == 1)
+    {
+        // Shift the bits after idx down by one.
+
+        uint64_t *wrds = ((leaf *)n -> child[j]) -> bits;
+        uint64_t wrdIdx = idx / 64, lowMask = (1ULL << (idx & 63)) - 1;
+        uint64_t lastWrd = (n -> size[j] - 1) / 64;
+
+        bit = (wrds[wrdIdx] >> (idx & 63)) & 1;
+        wrds[wrdIdx] = (wrds[wrdIdx] & lowMask) | ((wrds[wrdIdx] >> 1) & ~lowMask);
+
+        for(uint64_t k = wrdIdx; k < lastWrd; ++k)
+        {
+            wrds[k] |= wrds[k + 1] << 63;
+            wrds[k + 1] >>= 1;
+        }
+
+        n -> size[j]--, n -> ones[j] -= bit;
+
+        if(n -> size[j] < LEAF_BITS / 4 && n -> count > 1)
+            rebalance(n, j, level);
+    }
+    else
+    {
+        bit = erase((node *)n -> child[j], level - 1, idx);
+
+        n -> size[j]--, n -> ones[j] -= bit;
+
+        if(((node *)n -> child[j]) -> count < FANOUT / 4 && n -> count > 1)
+            rebalance(n, j, level);
+    }
+
+    return bit;
+}
+
+
+
+void dynamic_bit_vector::build(bit_vector &B)
+{
+    // Bulk load: the leaves are filled to three quarters, and every level of nodes is built
+    // over the one below it, each node with three quarters of FANOUT children; both spread
+    // evenly, so that none is left less than a quarter full.
+
+    free_subtree(root, height);
+
+    len = B.get_len();
+    oneCount = 0;
+
+    uint64_t cnt = std::max<uint64_t>(1, (len + LEAF_BITS * 3 / 4 - 1) / (LEAF_BITS * 3 / 4));
+    std::vector<void *> level(cnt);
+    std::vector<uint64_t> size(cnt), ones(cnt);
+
+    for(uint64_t i = 0; i < cnt; ++i)
+    {
+        leaf *l = new_leaf();
+        uint64_t start = i * len / cnt;
+
+        size[i] = (i + 1) * len / cnt - start;
+
+        for(uint64_t done = 0; done < size[i]; done += 64)
+        {
+            uint64_t chunk = std::min<uint64_t>(64, size[i] - done);
+            set_bits(l -> bits, done, chunk, B.get_int(start + done, chunk));
+        }
+
+        ones[i] = ones_in(l -> bits, size[i]);
+        oneCount += ones[i];
+        level[i] = l;
+    }
+
+
+    height = 0;
+
+    do
+    {
+        uint64_t nodes = (cnt + FANOUT * 3 / 4 - 1) / (FANOUT * 3 / 4);
+        std::vector<void *> upper(nodes);
+        std::vector<uint64_t> upperSize(nodes, 0), upperOnes(nodes, 0);
+
+        for(uint64_t i = 0; i < nodes; ++i)
+        {
+            node *n = new_node();
+
+            for(uint64_t k = i * cnt / nodes; k < (i + 1) * cnt / nodes; ++k)
+            {
+                insert_child(n, n -> count, level[k], size[k], ones[k]);
+                upperSize[i] += size[k], upperOnes[i] += ones[k];
+            }
+
+            upper[i] = n;
+        }
+
+        level.swap(upper), size.swap(upperSize), ones.swap(upperOnes);
+        cnt = nodes;
+        height++;
+    }
+    while(cnt > 1);
+
+    root = (node *)level[0];
+}
+
+
+
+bool dynamic_bit_vector::get_bit(uint64_t idx)
+{
+    node *n = root;
+
+    for(uint8_t level = height; ; --level)
+    {
+        uint8_t j = 0;
+        while(idx >= n -> size[j])
+            idx -= n -> size[j++];
+
+        if(level == 1)
+            return (((leaf *)n -> child[j]) -> bits[idx / 64] >> (idx & 63)) & 1;
+
+        n = (node *)n -> child[j];
+    }
+}
+
+
+
+void dynamic_bit_vector::set(uint64_t idx, bool bit)
+{
+    // Fixes the one counts along the path, if the bit changes.
+
+    if(get_bit(idx) == bit)
+        return;
+
+    int64_t delta = (bit ? 1 : -1);
+    node *n = root;
+
+    oneCount += delta;
+
+    for(uint8_t level = height; ; --level)
+    {
+        uint8_t j = 0;
+        while(idx >= n -> size[j])
+            idx -= n -> size[j++];
+
+        n -> ones[j] += delta;
+
+        if(level == 1)
+        {
+            ((leaf *)n -> child[j]) -> bits[idx / 64] ^= 1ULL << (idx & 63);
+            return;
+        }
+
+        n = (node *)n -> child[j];
+    }
+}
+
+
+
+void dynamic_bit_vector::insert(uint64_t idx, bool bit)
+{
+    // Inserts the bit before the idx'th one (0 <= idx <= len); a split root gets a new root
+    // above it.
+
+    node *sibling = insert(root, height, idx, bit);
+
+    if(sibling)
+    {
+        node *n = new_node();
+
+        insert_child(n, 0, root, 0, 0);
+        insert_child(n, 1, sibling, 0, 0);
+        sum_child(n, 0), sum_child(n, 1);
+
+        root = n;
+        height++;
+    }
+
+    len++, oneCount += bit;
+}
+
+
+
+void dynamic_bit_vector::erase(uint64_t idx)
+{
+    // Erases the idx'th bit (idx < len); a root left with a single node child is replaced by it.
+
+    oneCount -= erase(root, height, idx);
+    len--;
+
+    while(height > 1 && root -> count == 1)
+    {
+        node *n = root;
+
+        root = (node *)n -> child[0];
+        height--;
+
+        delete n;
+        nodeCnt--;
+    }
+}
+
+
+
+uint64_t dynamic_bit_vector::ones_before(uint64_t idx)
+{
+    // Returns the number of ones in [0, idx); idx <= len.
+
+    node *n = root;
+    uint64_t rank = 0;
+
+    for(uint8_t level = height; ; --level)
+    {
+        uint8_t j = 0;
+        while(j + 1 < n -> count && idx > n -> size[j])
+            rank += n -> ones[j], idx -= n -> size[j++];
+
+        if(level == 1)
+            return rank + ones_in(((leaf *)n -> child[j]) -> bits, idx);
+
+        n = (node *)n -> child[j];
+    }
+}
+
+
+
+uint64_t dynamic_bit_vector::select(uint64_t rank, bool bit)
+{
+    // Returns the position of the rank'th (from 1) one, or zero; or the max value, if none.
+
+    if(!rank || rank > (bit ? oneCount : len - oneCount))
+        return std::numeric_limits<uint64_t>::max();
+
+    node *n = root;
+    uint64_t pos = 0;
+
+    for(uint8_t level = height; ; --level)
+    {
+        uint8_t j = 0;
+        uint64_t count;
+
+        while(rank > (count = (bit ? n -> ones[j] : n -> size[j] - n -> ones[j])))
+            rank -= count, pos += n -> size[j++];
+
+        if(level == 1)
+        {
+            // The zeros past the leaf's length are never reached, as the rank is within it.
+
+            const uint64_t *wrds = ((leaf *)n -> child[j]) -> bits;
+
+            for(uint64_t k = 0; ; ++k)
+            {
+                uint64_t wrd = (bit ? wrds[k] : ~wrds[k]);
+
+                if(rank <= (count = __builtin_popcountll(wrd)))
+                    return pos + k * 64 + select_in_word(wrd, rank - 1);
+
+                rank -= count;
+            }
+        }
+
+        n = (node *)n -> child[j];
+    }
+}
+
+
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef EF_VECTOR_H
+#define EF_VECTOR_H
+
+#include<limits>
+#include<vector>
+
+#include "bit_vector.h"
+
+
+// Elias-Fano encoding of a sparse bitvector, as the sorted positions of its m ones in a
+// universe of n bits: the low l = floor(log2(n / m)) bits of every position are stored
+// verbatim in L; and the high bits in unary in H, the i'th one at the position
+// (pos_i >> l) + i. Thus the whole takes about m (2 + log2(n / m)) bits, independent of n.
+// Every SAMPLE_RATE'th one and zero of H is sampled, so selecting in H scans a few words:
+// select1 is a single select in H; and rank1, predecessor and successor find the bucket of
+// the high bits with a select of a zero in H, and scan its (few) low parts.
+
+class ef_vector
+{
+private:
+    const static uint64_t SAMPLE_RATE = 256;    // Every SAMPLE_RATE'th one (and zero) of H is sampled.
+
+    uint64_t len;       // Number of bits; the universe of the positions.
+    uint64_t oneCount;  // Number of ones.
+    uint8_t lowWrdSz;   // Bit-length for the low part of each position.
+    bit_vector L;       // Low parts of the positions.
+    bit_vector H;       // High parts of the positions, in unary.
+    bit_vector S_1;     // Positions in H of the (i * SAMPLE_RATE)'th ones (from 0).
+    bit_vector S_0;     // Positions in H of the (i * SAMPLE_RATE)'th zeroes (from 0).
+
+
+    inline uint64_t word(uint64_t wrdIdx, bool bit) { return bit ? H.get_word(wrdIdx) : ~H.get_word(wrdIdx); }
+    inline uint64_t low(uint64_t i) { return L.get_int(i * lowWrdSz, lowWrdSz); }
+    uint64_t select_high(uint64_t i, bool bit);
+    uint64_t bucket_start(uint64_t high);
+
+
+public:
+    ef_vector() { len = oneCount = 0, lowWrdSz = 0; }
+
+    void build(bit_vector &B);
+    void build(const std::vector<uint64_t> &positions, uint64_t len);
+    uint64_t get_len() { return len; }
+    uint64_t one_count() { return oneCount; }
+    bool get_bit(uint64_t idx) { return predecessor(idx) == idx; }
+    uint64_t rank1(uint64_t idx);
+    uint64_t select1(uint64_t rank);
+    uint64_t predecessor(uint64_t idx);
+    uint64_t successor(uint64_t idx);
+    uint64_t size_in_bits() { return L.get_len() + H.get_len() + S_1.get_len() + S_0.get_len(); }
+
+    void serialize(std::ofstream &output);
+    template<typename T_input> void deserialize(T_input &input);
+};
+
+
+
+void ef_vector::build(bit_vector &B)
+{
+    std::vector<uint64_t> positions;
+
+    for(uint64_t i = 0; i < B.word_count(); ++i)
+        for(uint64_t wrd = B.get_word(i); wrd; wrd &= wrd - 1)
+            positions.push_back(i * 64 + __builtin_ctzll(wrd));
+
+    build(positions, B.get_len());
+}
+
+
+
+void ef_vector::build(const std::vector<uint64_t> &positions, uint64_t len)
+{
+    // The positions must be increasing, and less than len.
+
+    this -> len = len;
+    oneCount = positions.size();
+
+    // Without ones, the high parts of the universe are collapsed to a single bucket.
+
+    lowWrdSz = 0;
+    while(oneCount ? (len / oneCount) >> (lowWrdSz + 1) : lowWrdSz < 63 && len >> lowWrdSz)
+        lowWrdSz++;
+
+    L.set_len(oneCount * lowWrdSz);
+    H.set_len(oneCount + (len >> lowWrdSz) + 1);
+
+    for(uint64_t i = 0; i < oneCount; ++i)
+    {
+        L.set_int(i * lowWrdSz, lowWrdSz, positions[i]);
+        H.set_bit((positions[i] >> lowWrdSz) + i);
+    }
+
+
+    // Sample the positions of every SAMPLE_RATE'th one and zero of H.
+
+    uint64_t zeroCount = H.get_len() - oneCount;
+
+    S_1.set_len(((oneCount + SAMPLE_RATE - 1) / SAMPLE_RATE) * 64);
+    S_0.set_len(((zeroCount + SAMPLE_RATE - 1) / SAMPLE_RATE) * 64);
+
+    uint64_t count[2] = {0, 0};
+
+    for(uint64_t i = 0; i < H.get_len(); ++i)
+    {
+        bool bit = H.get_bit(i);
+
+        if(count[bit]++ % SAMPLE_RATE == 0)
+            (bit ? S_1 : S_0).set_word((count[bit] - 1) / SAMPLE_RATE, i);
+    }
+}
+
+
+
+uint64_t ef_vector::select_high(uint64_t i, bool bit)
+{
+    // Returns the position in H of the i'th (from 0) one, or zero; scanning the words from
+    // the sampled position preceding it.
+
+    uint64_t smplIdx = i / SAMPLE_RATE;
+    uint64_t pos = (bit ? S_1 : S_0).get_word(smplIdx);
+    uint64_t count = smplIdx * SAMPLE_RATE;     // Bits of the queried kind before pos.
+
+    uint64_t wrdIdx = pos / 64;
+    uint64_t wrd = word(wrdIdx, bit) & (~0ULL << (pos & 63)), wrdRank;
+
+    while(count + (wrdRank = __builtin_popcountll(wrd)) <= i)
+    {
+        count += wrdRank;
+        wrd = word(++wrdIdx, bit);
+    }
+
+    return wrdIdx * 64 + select_in_word(wrd, i - count);
+}
+
+
+
+uint64_t ef_vector::bucket_start(uint64_t high)
+{
+    // Returns the position in H of the first one with the high part high (if any): right
+    // after the (high - 1)'th zero.
+
+    return high ? select_high(high - 1, 0) + 1 : 0;
+}
+
+
+
+uint64_t ef_vector::rank1(uint64_t idx)
+{
+    // Returns the number of ones in [0, idx]: those of the buckets before the one of idx,
+    // and those of its bucket with a low part up to that of idx.
+
+    if(!oneCount)
+        return 0;
+
+    idx = std::min(idx, len - 1);
+
+    uint64_t high = idx >> lowWrdSz, lowIdx = idx & ((1ULL << lowWrdSz) - 1);
+    uint64_t pos = bucket_start(high), i = pos - high;
+
+    for(; H.get_bit(pos) && low(i) <= lowIdx; ++pos)
+        i++;
+
+    return i;
+}
+
+
+
+uint64_t ef_vector::select1(uint64_t rank)
+{
+    if(!rank || rank > oneCount)
+        return std::numeric_limits<uint64_t>::max();
+
+    uint64_t i = rank - 1;
+
+    return ((select_high(i, 1) - i) << lowWrdSz) | low(i);
+}
+
+
+
+uint64_t ef_vector::predecessor(uint64_t idx)
+{
+    // Returns the greatest position of a one up to idx; or the max value, if none.
+
+    uint64_t rank = rank1(idx);
+
+    return rank ? select1(rank) : std::numeric_limits<uint64_t>::max();
+}
+
+
+
+uint64_t ef_vector::successor(uint64_t idx)
+{
+    // Returns the least position of a one from idx on; or the max value, if none.
+
+    uint64_t rank = (idx ? rank1(idx - 1) : 0);
+
+    return (idx < len && rank < oneCount) ? select1(rank + 1) : std::numeric_limits<uint64_t>::max();
+}
+
+
+
+void ef_vector::serialize(std::ofstream &output)
+{
+    output.write((const char *)&len, sizeof(len));
+    output.write((const char *)&oneCount, sizeof(oneCount));
+    output.write((const char *)&lowWrdSz, sizeof(lowWrdSz));
+
+    L.serialize(output);
+    H.serialize(output);
+    S_1.serialize(output);
+    S_0.serialize(output);
+}
+
+
+
+template<typename T_input>
+void ef_vector::deserialize(T_input &input)
+{
+    input.read((char *)&len, sizeof(len));
+    input.read((char *)&oneCount, sizeof(oneCount));
+    input.read((char *)&lowWrdSz, sizeof(lowWrdSz));
+
+    L.deserialize(input);
+    H.deserialize(input);
+    S_1.deserialize(input);
+    S_0.deserialize(input);
+}
+
+
+
+#endif
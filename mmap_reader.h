@@ -0,0 +1,158 @@
+#ifndef MMAP_READER_H
+#define MMAP_READER_H
+
+#include<cstdint>
+#include<cstring>
+#include<string>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+
+// Read-only, shared memory-mapping of a serialized index file, read sequentially like an
+// std::ifstream. Bitvectors are not copied out of the mapping, but viewed in place through
+// view_words(); so the mapping must outlive every structure deserialized from it, and the
+// processes mapping the same file share its pages in the page cache. Alternatively, load() reads
+// the whole file into a single private buffer, viewed the same way; so all the bitvectors of an
+// index are laid out contiguously in file order, and released at once with the reader.
+
+class mmap_reader
+{
+private:
+    const char *base;   // Start of the mapping.
+    uint64_t size;      // Size of the mapped file.
+    uint64_t pos;       // Read position in the file.
+    bool ok;            // Whether all the reads so far were within the file.
+    bool loaded;        // Whether base is a buffer read in by load(), rather than a mapping.
+
+    mmap_reader(const mmap_reader &);
+    mmap_reader &operator=(const mmap_reader &);
+
+
+public:
+    mmap_reader() { base = NULL, size = 0, pos = 0, ok = false, loaded = false; }
+    mmap_reader(const std::string &fileName): mmap_reader() { open(fileName); }
+
+    ~mmap_reader() { close(); }
+
+    bool open(const std::string &fileName);
+    bool load(const std::string &fileName);
+    void close();
+
+    void read(char *dst, uint64_t count);
+    const uint64_t *view_words(uint64_t wrdCnt);
+    uint64_t tellg()    { return pos; }
+    explicit operator bool() const { return ok; }
+};
+
+
+
+bool mmap_reader::open(const std::string &fileName)
+{
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(!fstat(fd, &st) && st.st_size > 0)
+    {
+        void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(addr != MAP_FAILED)
+            base = (const char *)addr, size = st.st_size, ok = true;
+    }
+
+    ::close(fd);    // The mapping stays valid after closing the descriptor.
+
+    return ok;
+}
+
+
+
+bool mmap_reader::load(const std::string &fileName)
+{
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(!fstat(fd, &st) && st.st_size > 0)
+    {
+        // Words, so that the buffer is 8-byte aligned like the file offsets of the bitvectors.
+
+        uint64_t *buf = new uint64_t[(st.st_size + 7) / 8];
+        uint64_t done = 0;
+        ssize_t bytes;
+
+        while(done < (uint64_t)st.st_size && (bytes = ::read(fd, (char *)buf + done, st.st_size - done)) > 0)
+            done += bytes;
+
+        if(done == (uint64_t)st.st_size)
+            base = (const char *)buf, size = st.st_size, ok = loaded = true;
+        else
+            delete[] buf;
+    }
+
+    ::close(fd);
+
+    return ok;
+}
+
+
+
+void mmap_reader::close()
+{
+    if(base && loaded)
+        delete[] (const uint64_t *)base;
+    else if(base)
+        munmap((void *)base, size);
+
+    base = NULL, size = 0, pos = 0, ok = false, loaded = false;
+}
+
+
+
+void mmap_reader::read(char *dst, uint64_t count)
+{
+    if(!count)  // dst may be the NULL data of an empty vector.
+        return;
+
+    if(pos + count > size)
+    {
+        ok = false;
+        memset(dst, 0, count);
+        return;
+    }
+
+    memcpy(dst, base + pos, count);
+    pos += count;
+}
+
+
+
+const uint64_t *mmap_reader::view_words(uint64_t wrdCnt)
+{
+    // The words are serialized at 8-byte aligned file offsets; and the mapping itself is
+    // page aligned (and a loaded buffer word aligned).
+
+    pos = (pos + 7) & ~7ULL;
+
+    if(pos + wrdCnt * 8 > size)
+    {
+        ok = false;
+        return NULL;
+    }
+
+    const uint64_t *wrds = (const uint64_t *)(base + pos);
+    pos += wrdCnt * 8;
+
+    return wrds;
+}
+
+
+
+#endif
@@ -0,0 +1,368 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include<cstdint>
+#include<cstdio>
+#include<cstring>
+#include<vector>
+#include<algorithm>
+#include<mutex>
+#include<ostream>
+
+#ifdef __linux__
+#include<linux/perf_event.h>
+#include<sys/syscall.h>
+#include<sys/ioctl.h>
+#include<unistd.h>
+#endif
+
+
+// Optional instrumentation of the query paths.
+//
+// perf_counters reads the hardware performance counters of Linux (perf_event_open) around a
+// region of code: cycles, instructions, last-level cache misses, dTLB misses and branch misses,
+// of the calling thread and of the threads it starts within the region (e.g. a task_pool's),
+// in user space. Every counter is opened on its own; so the ones a CPU (or a VM) lacks are only
+// reported unavailable. If the kernel multiplexes the counters, their counts are scaled.
+//
+// With WT_COUNT_OPS defined at compile time, the operations of the queries are counted per
+// level of the wavelet tree (or matrix) too: the node operations (a rank or a select on the
+// bitvector of a node at the level), and the rank_support::rank1 calls they take (a select may
+// take several); a rank1 call is counted at the level of the thread's last node operation.
+// Without it, the counting compiles to nothing.
+
+
+// Counts of the operations per level; see WT_COUNT_OPS above.
+
+struct op_counts
+{
+    const static uint8_t MAX_LEVELS = 33;
+
+    uint64_t nodeOps[MAX_LEVELS];   // Rank and select operations on the node bitvectors, per level.
+    uint64_t rankCalls[MAX_LEVELS]; // rank_support::rank1 calls, per level.
+    uint8_t level;                  // Level of the node operated on last.
+};
+
+
+
+// The counts of every thread; those of the exited threads are kept too, so that a region's
+// counts include its pool threads'.
+struct op_counts_registry
+{
+    std::mutex lock;
+    std::vector<op_counts *> counts;
+
+    static op_counts_registry &get() { static op_counts_registry registry; return registry; }
+};
+
+
+
+inline op_counts &thread_op_counts()
+{
+    static thread_local op_counts *counts = NULL;
+
+    if(!counts)
+    {
+        counts = new op_counts();
+
+        op_counts_registry &registry = op_counts_registry::get();
+        std::lock_guard<std::mutex> guard(registry.lock);
+
+        registry.counts.push_back(counts);
+    }
+
+    return *counts;
+}
+
+
+
+#ifdef WT_COUNT_OPS
+inline void count_node_op(uint8_t level)
+{
+    op_counts &c = thread_op_counts();
+
+    c.level = std::min<uint8_t>(level, op_counts::MAX_LEVELS - 1);
+    c.nodeOps[c.level]++;
+}
+
+inline void count_rank_call() { op_counts &c = thread_op_counts(); c.rankCalls[c.level]++; }
+#else
+inline void count_node_op(uint8_t) {}
+inline void count_rank_call() {}
+#endif
+
+
+
+// Sums the counts of all the threads into total, and resets them if reset is set; the counts of
+// the threads running meanwhile may be slightly off.
+inline void collect_op_counts(op_counts &total, bool reset)
+{
+    op_counts_registry &registry = op_counts_registry::get();
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    memset(&total, 0, sizeof(total));
+
+    for(auto c = registry.counts.begin(); c != registry.counts.end(); ++c)
+    {
+        for(uint8_t l = 0; l < op_counts::MAX_LEVELS; ++l)
+            total.nodeOps[l] += (*c) -> nodeOps[l], total.rankCalls[l] += (*c) -> rankCalls[l];
+
+        if(reset)
+            memset((*c) -> nodeOps, 0, sizeof((*c) -> nodeOps)), memset((*c) -> rankCalls, 0, sizeof((*c) -> rankCalls));
+    }
+}
+
+
+
+class perf_counters
+{
+public:
+    enum event { CYCLES, INSTRUCTIONS, LLC_MISSES, DTLB_MISSES, BRANCH_MISSES, EVENT_COUNT };
+
+private:
+    int fd[EVENT_COUNT];            // Descriptor of each counter; -1 if unavailable.
+    uint64_t value[EVENT_COUNT];    // Counts accumulated over the measured regions.
+    op_counts ops;                  // Operation counts accumulated over them, with WT_COUNT_OPS.
+
+    perf_counters(const perf_counters &);
+    perf_counters &operator=(const perf_counters &);
+
+    void open_counter(event e);
+
+
+public:
+    perf_counters();
+    ~perf_counters();
+
+    static const char *name(event e);
+    bool available(event e) { return fd[e] >= 0; }
+    void start();
+    void stop();
+    double per_op(event e, uint64_t opCount) { return available(e) && opCount ? double(value[e]) / opCount : -1; }
+    const op_counts &op_counts_total() const { return ops; }
+    void report(std::ostream &output, uint64_t opCount);
+};
+
+
+
+perf_counters::perf_counters()
+{
+    memset(&ops, 0, sizeof(ops));
+
+    for(int e = 0; e < EVENT_COUNT; ++e)
+    {
+        value[e] = 0;
+        open_counter((event)e);
+    }
+}
+
+
+
+perf_counters::~perf_counters()
+{
+#ifdef __linux__
+    for(int e = 0; e < EVENT_COUNT; ++e)
+        if(fd[e] >= 0)
+            close(fd[e]);
+#endif
+}
+
+
+
+const char *perf_counters::name(event e)
+{
+    static const char *names[EVENT_COUNT] = {"cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"};
+
+    return names[e];
+}
+
+
+
+void perf_counters::open_counter(event e)
+{
+    fd[e] = -1;
+
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.inherit = 1;   // The threads started in the region count too; a thread's counts are added on its exit.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch(e)
+    {
+        case CYCLES:
+            attr.type = PERF_TYPE_HARDWARE, attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+
+        case INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE, attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+
+        case LLC_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+
+        case DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+
+        default:
+            attr.type = PERF_TYPE_HARDWARE, attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    }
+
+    fd[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+
+
+void perf_counters::start()
+{
+    op_counts discard;
+    collect_op_counts(discard, true);
+
+#ifdef __linux__
+    for(int e = 0; e < EVENT_COUNT; ++e)
+        if(fd[e] >= 0)
+        {
+            ioctl(fd[e], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd[e], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+}
+
+
+
+void perf_counters::stop()
+{
+    // Adds the counts of the region to the accumulated ones (the hardware counts scaled by the fraction of the
+    // region the counter was actually scheduled on the PMU, if multiplexed).
+
+#ifdef __linux__
+    for(int e = 0; e < EVENT_COUNT; ++e)
+        if(fd[e] >= 0)
+        {
+            ioctl(fd[e], PERF_EVENT_IOC_DISABLE, 0);
+
+            uint64_t buf[3];    // The count, and the times enabled and running.
+            if(read(fd[e], buf, sizeof(buf)) != sizeof(buf))
+                continue;
+
+            value[e] += (buf[2] && buf[2] < buf[1] ? uint64_t(double(buf[0]) * buf[1] / buf[2]) : buf[0]);
+        }
+#endif
+
+    op_counts region;
+    collect_op_counts(region, true);
+
+    for(uint8_t l = 0; l < op_counts::MAX_LEVELS; ++l)
+        ops.nodeOps[l] += region.nodeOps[l], ops.rankCalls[l] += region.rankCalls[l];
+}
+
+
+
+void perf_counters::report(std::ostream &output, uint64_t opCount)
+{
+    // Writes the counts per operation, and with WT_COUNT_OPS the operation counts per level;
+    // one "name: value" line each.
+
+    char line[128];
+
+    snprintf(line, sizeof(line), "queries: %llu\n", (unsigned long long)opCount);
+    output << line;
+
+    for(int e = 0; e < EVENT_COUNT; ++e)
+    {
+        if(available((event)e))
+            snprintf(line, sizeof(line), "%s per query: %.2f\n", name((event)e), per_op((event)e, opCount));
+        else
+            snprintf(line, sizeof(line), "%s per query: n/a\n", name((event)e));
+
+        output << line;
+    }
+
+    if(!available(CYCLES) && !available(INSTRUCTIONS))
+        output << "(hardware counters unavailable; see /proc/sys/kernel/perf_event_paranoid)\n";
+
+#ifdef WT_COUNT_OPS
+    const op_counts &total = ops;
+    uint64_t nodeOps = 0, rankCalls = 0;
+
+    for(uint8_t l = 0; l < op_counts::MAX_LEVELS; ++l)
+    {
+        nodeOps += total.nodeOps[l], rankCalls += total.rankCalls[l];
+
+        if(total.nodeOps[l] || total.rankCalls[l])
+        {
+            snprintf(line, sizeof(line), "level %d: node ops per query: %.3f, rank1 calls per query: %.3f\n", (int)l,
+                        double(total.nodeOps[l]) / opCount, double(total.rankCalls[l]) / opCount);
+            output << line;
+        }
+    }
+
+    snprintf(line, sizeof(line), "node ops per query: %.3f\nrank1 calls per query: %.3f\n",
+                double(nodeOps) / opCount, double(rankCalls) / opCount);
+    output << line;
+#endif
+
+    output.flush();
+}
+
+
+
+// Measures a query loop on the counters, if profile is set: from the construction on, until
+// finish(qCount), which reports the counts per query of the qCount queries answered.
+
+class query_profile
+{
+private:
+    perf_counters *counters;
+
+    query_profile(const query_profile &);
+    query_profile &operator=(const query_profile &);
+
+
+public:
+    query_profile(bool profile);
+    ~query_profile() { delete counters; }
+
+    void finish(uint64_t qCount, std::ostream &output);
+};
+
+
+
+query_profile::query_profile(bool profile)
+{
+    counters = NULL;
+
+    if(!profile)
+        return;
+
+    counters = new perf_counters();
+    counters -> start();
+}
+
+
+
+void query_profile::finish(uint64_t qCount, std::ostream &output)
+{
+    if(!counters)
+        return;
+
+    counters -> stop();
+    counters -> report(output, qCount);
+
+    delete counters;
+    counters = NULL;
+}
+
+
+
+#endif
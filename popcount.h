@@ -0,0 +1,175 @@
+#ifndef POPCOUNT_H
+#define POPCOUNT_H
+
+#include<cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define POPCOUNT_X86
+#include<immintrin.h>
+#endif
+
+
+// Bulk popcount kernels over arrays of 64-bit words, selected at run time by the CPU features:
+// AVX-512 VPOPCNTDQ, AVX2 (Harley-Seal carry-save adder network over 256-bit vectors, after
+// Mula, Kurz and Lemire, 2018), or a scalar fallback. The SIMD kernels are compiled through
+// function target attributes; so no -m flags are required for them.
+
+typedef uint64_t (*popcount_kernel)(const uint64_t *wrds, uint64_t wrdCnt);
+
+
+inline uint64_t popcount_words_scalar(const uint64_t *wrds, uint64_t wrdCnt)
+{
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0, i = 0;
+
+    for(; i + 4 <= wrdCnt; i += 4)
+    {
+        c0 += __builtin_popcountll(wrds[i]);
+        c1 += __builtin_popcountll(wrds[i + 1]);
+        c2 += __builtin_popcountll(wrds[i + 2]);
+        c3 += __builtin_popcountll(wrds[i + 3]);
+    }
+
+    for(; i < wrdCnt; ++i)
+        c0 += __builtin_popcountll(wrds[i]);
+
+    return c0 + c1 + c2 + c3;
+}
+
+
+
+#ifdef POPCOUNT_X86
+
+// Per-64-bit-lane popcounts of a 256-bit vector, through nibble lookups.
+__attribute__((target("avx2")))
+inline __m256i popcount_256(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+
+    __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, lowMask));
+    __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask));
+
+    return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+
+
+// Carry-save adder: (h, l) = a + b + c, bitwise.
+__attribute__((target("avx2")))
+inline void csa_256(__m256i &h, __m256i &l, __m256i a, __m256i b, __m256i c)
+{
+    __m256i u = _mm256_xor_si256(a, b);
+
+    h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+    l = _mm256_xor_si256(u, c);
+}
+
+
+
+__attribute__((target("avx2")))
+inline uint64_t popcount_words_avx2(const uint64_t *wrds, uint64_t wrdCnt)
+{
+    // Sixteen vectors are reduced to one vector of "sixteens" per iteration, whose popcount
+    // is accumulated; the lower-order ones, twos, fours and eights carry across iterations.
+
+    const __m256i *v = (const __m256i *)wrds;
+    uint64_t vecCnt = wrdCnt / 4, i = 0;
+
+    __m256i total = _mm256_setzero_si256();
+    __m256i ones = _mm256_setzero_si256(), twos = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256(), eights = _mm256_setzero_si256(), sixteens;
+    __m256i twosA, twosB, foursA, foursB, eightsA, eightsB;
+
+    for(; i + 16 <= vecCnt; i += 16)
+    {
+        csa_256(twosA, ones, ones, _mm256_loadu_si256(v + i), _mm256_loadu_si256(v + i + 1));
+        csa_256(twosB, ones, ones, _mm256_loadu_si256(v + i + 2), _mm256_loadu_si256(v + i + 3));
+        csa_256(foursA, twos, twos, twosA, twosB);
+        csa_256(twosA, ones, ones, _mm256_loadu_si256(v + i + 4), _mm256_loadu_si256(v + i + 5));
+        csa_256(twosB, ones, ones, _mm256_loadu_si256(v + i + 6), _mm256_loadu_si256(v + i + 7));
+        csa_256(foursB, twos, twos, twosA, twosB);
+        csa_256(eightsA, fours, fours, foursA, foursB);
+        csa_256(twosA, ones, ones, _mm256_loadu_si256(v + i + 8), _mm256_loadu_si256(v + i + 9));
+        csa_256(twosB, ones, ones, _mm256_loadu_si256(v + i + 10), _mm256_loadu_si256(v + i + 11));
+        csa_256(foursA, twos, twos, twosA, twosB);
+        csa_256(twosA, ones, ones, _mm256_loadu_si256(v + i + 12), _mm256_loadu_si256(v + i + 13));
+        csa_256(twosB, ones, ones, _mm256_loadu_si256(v + i + 14), _mm256_loadu_si256(v + i + 15));
+        csa_256(foursB, twos, twos, twosA, twosB);
+        csa_256(eightsB, fours, fours, foursA, foursB);
+        csa_256(sixteens, eights, eights, eightsA, eightsB);
+
+        total = _mm256_add_epi64(total, popcount_256(sixteens));
+    }
+
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount_256(eights), 3));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount_256(fours), 2));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount_256(twos), 1));
+    total = _mm256_add_epi64(total, popcount_256(ones));
+
+    for(; i < vecCnt; ++i)
+        total = _mm256_add_epi64(total, popcount_256(_mm256_loadu_si256(v + i)));
+
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, total);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + popcount_words_scalar(wrds + vecCnt * 4, wrdCnt % 4);
+}
+
+
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+inline uint64_t popcount_words_avx512(const uint64_t *wrds, uint64_t wrdCnt)
+{
+    __m512i total = _mm512_setzero_si512();
+    uint64_t i = 0;
+
+    for(; i + 8 <= wrdCnt; i += 8)
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512(wrds + i)));
+
+    if(i < wrdCnt)  // Masked load of the last (up to 7) words.
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64((1 << (wrdCnt - i)) - 1, wrds + i)));
+
+    uint64_t lanes[8];
+    _mm512_storeu_si512(lanes, total);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+}
+
+#endif
+
+
+
+inline popcount_kernel best_popcount_kernel()
+{
+#ifdef POPCOUNT_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx512vpopcntdq"))
+        return popcount_words_avx512;
+
+    if(__builtin_cpu_supports("avx2"))
+        return popcount_words_avx2;
+#endif
+
+    return popcount_words_scalar;
+}
+
+
+
+// Returns the number of ones in the wrdCnt words starting at wrds.
+inline uint64_t popcount_words(const uint64_t *wrds, uint64_t wrdCnt)
+{
+    static const popcount_kernel kernel = best_popcount_kernel();
+
+    if(wrdCnt < 8)  // Not worth an indirect call.
+        return popcount_words_scalar(wrds, wrdCnt);
+
+    return kernel(wrds, wrdCnt);
+}
+
+
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef QUERY_DRIVERS_H
+#define QUERY_DRIVERS_H
+
+#include<cstdint>
+#include<cstdlib>
+#include<string>
+#include<vector>
+#include<limits>
+#include<utility>
+#include<iostream>
+
+#include "alphabet_map.h"
+#include "batch_executor.h"
+#include "mmap_reader.h"
+#include "perf_counters.h"
+#include "query_io.h"
+
+
+// The access, rank and select commands of wt, over an index saved to a file: a wavelet tree, or a
+// wavelet matrix, whose classes forward their *_queries to these. The queries are read in whole,
+// and answered by the batch calls of the index in chunks (in parallel, with threadCount > 1); the
+// results are written to standard out in the query order, as text or, with binary set, as
+// little-endian 64-bit words. With profile set, the answering is measured on the performance
+// counters; see perf_counters.h. T_index needs only deserialize, get_len, and the batch access,
+// rank and select.
+
+template<typename T_index>
+class query_drivers
+{
+public:
+    static void access_queries(std::string &indexFile, std::string &accessIndices, bool mmapped, unsigned threadCount, bool binary,
+                                bool profile);
+    static void rank_queries(std::string &indexFile, std::string &queryIndices, bool mmapped, unsigned threadCount, bool binary,
+                                bool profile);
+    static void select_queries(std::string &indexFile, std::string &queryIndices, bool mmapped, unsigned threadCount, bool binary,
+                                bool profile);
+};
+
+
+
+template<typename T_index>
+void query_drivers<T_index>::access_queries(std::string &indexFile, std::string &accessIndices, bool mmapped, unsigned threadCount,
+                                            bool binary, bool profile)
+{
+    alphabet_map alphabet;
+
+    mmap_reader mapping;
+    T_index index;
+    index.deserialize(indexFile, alphabet, mmapped ? &mapping : NULL);
+
+    // Collect the queries, and answer them in an interleaved batch per chunk.
+
+    query_reader input(accessIndices, binary);
+    uint64_t idx;
+
+    std::vector<uint64_t> indices;
+
+    while(input.read_int(idx))
+    {
+        // Out of range indices are rejected, like by query_server, before any answer is written.
+
+        if(idx >= index.get_len())
+        {
+            std::cerr << "Access index " << idx << " out of range; the text has " << index.get_len() << " characters.\n";
+            exit(1);
+        }
+
+        indices.push_back(idx);
+    }
+
+
+    // The chunks are answered in parallel; the loaded index is only read.
+
+    query_profile prof(profile);
+
+    task_pool *pool = (threadCount > 1 ? new task_pool(threadCount) : NULL);
+
+    run_chunked(indices.size(), pool, std::cout, [&](uint64_t b, uint64_t e, std::string &out)
+        {
+            std::vector<uint64_t> chunk(indices.begin() + b, indices.begin() + e);
+            std::vector<uint32_t> result;
+
+            index.access(chunk, result);
+
+            for(uint64_t i = 0; i < result.size(); ++i)
+                if(binary)
+                    append_word(out, alphabet.symbol(result[i]));
+                else
+                    alphabet.append_symbol(out, result[i]), out += '\n';
+        });
+
+    delete pool;
+
+    prof.finish(indices.size(), std::cerr);
+}
+
+
+
+template<typename T_index>
+void query_drivers<T_index>::rank_queries(std::string &indexFile, std::string &queryIndices, bool mmapped, unsigned threadCount,
+                                            bool binary, bool profile)
+{
+    alphabet_map alphabet;
+
+    mmap_reader mapping;
+    T_index index;
+    index.deserialize(indexFile, alphabet, mmapped ? &mapping : NULL);
+
+
+    // Collect the queries, and answer them in a batch per chunk; characters absent from the
+    // text have a rank of 0 everywhere.
+
+    query_reader input(queryIndices, binary);
+    uint32_t ch, code = 0;
+    uint64_t idx;
+
+    std::vector<std::pair<uint32_t, uint64_t>> queries;
+    std::vector<bool> present;
+
+    while(alphabet.read_symbol(input, ch) && input.read_int(idx))
+    {
+        present.push_back(alphabet.find(ch, code));
+        queries.push_back(std::make_pair(code, idx));
+    }
+
+
+    query_profile prof(profile);
+
+    task_pool *pool = (threadCount > 1 ? new task_pool(threadCount) : NULL);
+
+    run_chunked(queries.size(), pool, std::cout, [&](uint64_t b, uint64_t e, std::string &out)
+        {
+            std::vector<std::pair<uint32_t, uint64_t>> chunk;
+            std::vector<uint64_t> result;
+
+            for(uint64_t i = b; i < e; ++i)
+                if(present[i])
+                    chunk.push_back(queries[i]);
+
+            index.rank(chunk, result);
+
+            for(uint64_t i = b, j = 0; i < e; ++i)
+                append_result(out, present[i] ? result[j++] : 0, binary);
+        });
+
+    delete pool;
+
+    prof.finish(queries.size(), std::cerr);
+}
+
+
+
+template<typename T_index>
+void query_drivers<T_index>::select_queries(std::string &indexFile, std::string &queryIndices, bool mmapped, unsigned threadCount,
+                                            bool binary, bool profile)
+{
+    alphabet_map alphabet;
+
+    mmap_reader mapping;
+    T_index index;
+    index.deserialize(indexFile, alphabet, mmapped ? &mapping : NULL);
+
+
+    // Collect the queries, and answer them in an interleaved batch per chunk; characters absent from
+    // the text have no occurrences.
+
+    query_reader input(queryIndices, binary);
+    uint32_t ch, code = 0;
+    uint64_t rank;
+
+    std::vector<std::pair<uint32_t, uint64_t>> queries;
+    std::vector<bool> present;
+
+    while(alphabet.read_symbol(input, ch) && input.read_int(rank))
+    {
+        present.push_back(alphabet.find(ch, code));
+        queries.push_back(std::make_pair(code, rank));
+    }
+
+
+    query_profile prof(profile);
+
+    task_pool *pool = (threadCount > 1 ? new task_pool(threadCount) : NULL);
+
+    run_chunked(queries.size(), pool, std::cout, [&](uint64_t b, uint64_t e, std::string &out)
+        {
+            std::vector<std::pair<uint32_t, uint64_t>> chunk;
+            std::vector<uint64_t> result;
+
+            for(uint64_t i = b; i < e; ++i)
+                if(present[i])
+                    chunk.push_back(queries[i]);
+
+            index.select(chunk, result);
+
+            for(uint64_t i = b, j = 0; i < e; ++i)
+                append_result(out, present[i] ? result[j++] : std::numeric_limits<uint64_t>::max(), binary);
+        });
+
+    delete pool;
+
+    prof.finish(queries.size(), std::cerr);
+}
+
+
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef QUERY_IO_H
+#define QUERY_IO_H
+
+#include<cstdint>
+#include<cstring>
+#include<string>
+#include<vector>
+#include<ostream>
+#include<fcntl.h>
+#include<unistd.h>
+
+
+// Fast I/O of the query files and the results: the query files are read in large blocks and
+// parsed by hand, instead of through formatted stream extraction; and the results are formatted
+// by hand into large buffers, written out a block at a time. In the binary format, every number
+// of a query or a result is a little-endian 64-bit word instead of a line of text; a symbol
+// takes a word too, of which only the low 32 bits are read.
+
+
+
+// Appends the decimal digits of val to output, two digits at a time.
+inline void append_int(std::string &output, uint64_t val)
+{
+    struct digit_pairs
+    {
+        char pair[200];     // The two digits of each of 00, ..., 99.
+
+        digit_pairs()
+        {
+            for(int i = 0; i < 100; ++i)
+                pair[2 * i] = '0' + i / 10, pair[2 * i + 1] = '0' + i % 10;
+        }
+    };
+
+    static const digit_pairs d;
+
+    char buf[20];
+    char *p = buf + sizeof(buf);
+
+    for(; val >= 100; val /= 100)
+        memcpy(p -= 2, d.pair + 2 * (val % 100), 2);
+
+    if(val >= 10)
+        memcpy(p -= 2, d.pair + 2 * val, 2);
+    else
+        *--p = '0' + val;
+
+    output.append(p, buf + sizeof(buf) - p);
+}
+
+
+
+// Appends val to output as a little-endian 64-bit word.
+inline void append_word(std::string &output, uint64_t val)
+{
+    char buf[8];
+
+    for(int i = 0; i < 8; ++i)
+        buf[i] = (char)(val >> (8 * i));
+
+    output.append(buf, 8);
+}
+
+
+
+// Appends a numeric result to output: as a line of text, or as a word in the binary format.
+inline void append_result(std::string &output, uint64_t val, bool binary)
+{
+    if(binary)
+        append_word(output, val);
+    else
+        append_int(output, val), output += '\n';
+}
+
+
+
+// Reader of a query file, in blocks of BLOCK_SIZE bytes; a block is refilled once the
+// remaining bytes are too few for the next number.
+
+class query_reader
+{
+private:
+    const static uint64_t BLOCK_SIZE = 1 << 20;
+
+    int fd;                 // Descriptor of the query file; -1 if it could not be opened.
+    bool binary;            // Whether the file is in the binary format.
+    std::vector<char> buf;  // Current block; the unread bytes are [pos, end).
+    uint64_t pos;
+    uint64_t end;
+
+    query_reader(const query_reader &);
+    query_reader &operator=(const query_reader &);
+
+    bool fill(uint64_t count);
+    inline int peek() { return pos < end || fill(1) ? (uint8_t)buf[pos] : -1; }
+    bool read_text(uint64_t &val);
+    bool read_word(uint64_t &val);
+
+
+public:
+    query_reader(const std::string &fileName, bool binary = false);
+    ~query_reader() { if(fd >= 0) ::close(fd); }
+
+    bool read_int(uint64_t &val) { return binary ? read_word(val) : read_text(val); }
+    bool read_symbol(uint32_t &symbol, bool bytes);
+};
+
+
+
+query_reader::query_reader(const std::string &fileName, bool binary):
+    fd(::open(fileName.c_str(), O_RDONLY)),
+    binary(binary),
+    buf(BLOCK_SIZE),
+    pos(0),
+    end(0)
+{
+}
+
+
+
+bool query_reader::fill(uint64_t count)
+{
+    // Moves the unread bytes to the front of the block, and reads in more after them; returns
+    // whether at least count bytes are unread then.
+
+    if(pos)
+    {
+        memmove(buf.data(), buf.data() + pos, end - pos);
+        end -= pos, pos = 0;
+    }
+
+    while(fd >= 0 && end < count)
+    {
+        ssize_t bytes = ::read(fd, buf.data() + end, BLOCK_SIZE - end);
+        if(bytes <= 0)
+            break;
+
+        end += bytes;
+    }
+
+    return end >= count;
+}
+
+
+
+bool query_reader::read_text(uint64_t &val)
+{
+    // Reads a decimal integer, after any whitespace; fails at a non-digit, like the formatted
+    // extraction of an unsigned integer.
+
+    int c;
+    while((c = peek()) == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f')
+        pos++;
+
+    if(c < '0' || c > '9')
+        return false;
+
+    val = 0;
+
+    do
+    {
+        val = val * 10 + (c - '0');
+        pos++;
+    }
+    while((c = peek()) >= '0' && c <= '9');
+
+    return true;
+}
+
+
+
+bool query_reader::read_word(uint64_t &val)
+{
+    if(end - pos < 8 && !fill(8))
+        return false;
+
+    val = 0;
+    for(int i = 7; i >= 0; --i)
+        val = (val << 8) | (uint8_t)buf[pos + i];
+
+    pos += 8;
+    return true;
+}
+
+
+
+bool query_reader::read_symbol(uint32_t &symbol, bool bytes)
+{
+    // Reads a symbol: a word in the binary format; otherwise a single non-whitespace
+    // character, or an integer.
+
+    uint64_t val;
+
+    if(binary || !bytes)
+    {
+        if(!read_int(val))
+            return false;
+
+        symbol = (uint32_t)val;
+        return true;
+    }
+
+    int c;
+    while((c = peek()) == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f')
+        pos++;
+
+    if(c < 0)
+        return false;
+
+    symbol = c, pos++;
+    return true;
+}
+
+
+
+// Buffer of the results of a query file, written out to output once it reaches BLOCK_SIZE bytes
+// (and on destruction). A result is appended to line(), and completed with end_line().
+
+class result_writer
+{
+private:
+    const static uint64_t BLOCK_SIZE = 1 << 20;
+
+    std::ostream &output;
+    std::string buf;
+
+    result_writer(const result_writer &);
+    result_writer &operator=(const result_writer &);
+
+
+public:
+    result_writer(std::ostream &output): output(output) { buf.reserve(BLOCK_SIZE + 4096); }
+    ~result_writer() { flush(); }
+
+    std::string &line() { return buf; }
+    void end_line() { buf += '\n'; if(buf.size() >= BLOCK_SIZE) flush(); }
+    void flush() { output.write(buf.data(), buf.size()); output.flush(); buf.clear(); }
+};
+
+
+
+#endif
@@ -0,0 +1,460 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<cctype>
+#include<cerrno>
+#include<csignal>
+#include<string>
+#include<vector>
+#include<poll.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/socket.h>
+#include<sys/stat.h>
+#include<sys/un.h>
+
+#include "wavelet_tree.h"
+#include "wavelet_matrix.h"
+
+
+// Persistent query server over an index loaded once: a wavelet tree, or a wavelet matrix. The
+// requests are lines of whitespace-separated fields,
+//
+//   access <i>  |  rank <c> <i>  |  select <c> <k>
+//   quantile <i> <j> <k>  |  count <i> <j> <lo> <hi>  |  next <i> <j> <x>  |  topk <i> <j> <k>
+//
+// each answered by a line, in order, in the format of the wt command of the same name; or by
+// "ERR <reason>" for a malformed or unsupported request. Requests may be pipelined: all the
+// complete lines read from a client are answered into its output buffer, which is written out
+// once its input runs dry. The requests arrive on a pipe (stdin), or on the connections to a
+// Unix domain socket, served by a single-threaded poll loop.
+
+template<typename T_index>
+class query_server
+{
+private:
+    const static uint64_t READ_CHUNK = 1 << 16;         // Bytes read at a time.
+    const static uint64_t MAX_PENDING_OUT = 1 << 22;    // Output bytes over which a client is not read from.
+    const static int MAX_FIELDS = 5;                    // Max number of fields in a request.
+    const static uint64_t MAX_REQUEST_LEN = 1 << 12;    // Max bytes in a request line.
+
+    struct connection
+    {
+        int inFd;
+        int outFd;
+        std::string in;     // Input not answered yet: an incomplete line.
+        std::string out;    // Answers not written yet.
+        bool eof;           // Whether the input is closed.
+        bool skipping;      // Whether the rest of a request line too long is being discarded.
+    };
+
+    T_index &index;
+    alphabet_map &alphabet;
+    std::vector<uint32_t> least;    // Least symbols of the subtrees, for the topk ties of a Huffman-shaped tree; on demand.
+
+
+    bool parse_number(const std::string &field, uint64_t &val);
+    bool parse_symbol(const std::string &field, uint32_t &symbol);
+    void answer(const char *line, const char *end, std::string &out);
+    bool answer_range(wavelet_tree &wt, std::string *field, int fieldCnt, std::string &out);
+    bool answer_range(wavelet_matrix &, std::string *, int, std::string &) { return false; }
+    void process(connection &conn);
+    static bool write_out(connection &conn, bool blocking);
+
+
+public:
+    query_server(T_index &index, alphabet_map &alphabet): index(index), alphabet(alphabet) {}
+
+    void serve_stream(int inFd, int outFd);
+    bool serve_socket(const std::string &path);
+};
+
+
+
+template<typename T_index>
+bool query_server<T_index>::parse_number(const std::string &field, uint64_t &val)
+{
+    if(field.empty() || field[0] < '0' || field[0] > '9')
+        return false;
+
+    char *end;
+    errno = 0;
+    val = strtoull(field.c_str(), &end, 10);
+
+    return !*end && !errno;
+}
+
+
+
+template<typename T_index>
+bool query_server<T_index>::parse_symbol(const std::string &field, uint32_t &symbol)
+{
+    // A single character; or an integer, for integer alphabets.
+
+    if(alphabet.is_bytes())
+    {
+        symbol = (uint8_t)field[0];
+        return field.size() == 1;
+    }
+
+    uint64_t val;
+    if(!parse_number(field, val) || val > std::numeric_limits<uint32_t>::max())
+        return false;
+
+    symbol = val;
+    return true;
+}
+
+
+
+template<typename T_index>
+void query_server<T_index>::answer(const char *line, const char *end, std::string &out)
+{
+    std::string field[MAX_FIELDS];
+    int fieldCnt = 0;
+
+    for(const char *p = line; p < end; )
+    {
+        while(p < end && isspace((unsigned char)*p))
+            p++;
+
+        const char *q = p;
+        while(q < end && !isspace((unsigned char)*q))
+            q++;
+
+        if(q == p)
+            break;
+
+        if(fieldCnt == MAX_FIELDS)
+        {
+            out += "ERR too many fields\n";
+            return;
+        }
+
+        field[fieldCnt++].assign(p, q);
+        p = q;
+    }
+
+    if(!fieldCnt)
+    {
+        out += "ERR empty request\n";
+        return;
+    }
+
+
+    const std::string &cmd = field[0];
+    uint64_t idx;
+    uint32_t ch, code = 0;
+
+    if(cmd == "access")
+    {
+        if(fieldCnt != 2 || !parse_number(field[1], idx))
+            out += "ERR usage: access <i>\n";
+        else if(idx >= index.get_len())
+            out += "ERR index out of range\n";
+        else
+        {
+            alphabet.append_symbol(out, index.access(idx));
+            out += '\n';
+        }
+    }
+    else if(cmd == "rank" || cmd == "select")
+    {
+        // Symbols absent from the text have a rank of 0 everywhere, and no occurrences.
+
+        if(fieldCnt != 3 || !parse_symbol(field[1], ch) || !parse_number(field[2], idx))
+            out += "ERR usage: " + cmd + " <c> <i>\n";
+        else if(!alphabet.find(ch, code))
+            out += (cmd == "rank" ? "0\n" : std::to_string(std::numeric_limits<uint64_t>::max()) + "\n");
+        else if(cmd == "rank")
+            out += std::to_string(index.rank(code, idx)) + "\n";
+        else
+            out += std::to_string(index.select(code, idx)) + "\n";
+    }
+    else if(!answer_range(index, field, fieldCnt, out))
+        out += "ERR unsupported request " + cmd + "\n";
+}
+
+
+
+template<typename T_index>
+bool query_server<T_index>::answer_range(wavelet_tree &wt, std::string *field, int fieldCnt, std::string &out)
+{
+    // The range queries of the tree; see the wt commands of the same names. Returns false for
+    // an unknown command.
+
+    const std::string &cmd = field[0];
+    uint64_t i, j, k;
+    uint32_t lo, hi, ch = 0;
+
+    if(cmd != "quantile" && cmd != "count" && cmd != "next" && cmd != "topk")
+        return false;
+
+    if(cmd != "topk" && !alphabet.is_ordered())
+    {
+        out += "ERR " + cmd + " requires a tree built without --huffman\n";
+        return true;
+    }
+
+
+    if(cmd == "quantile")
+    {
+        if(fieldCnt != 4 || !parse_number(field[1], i) || !parse_number(field[2], j) || !parse_number(field[3], k))
+            out += "ERR usage: quantile <i> <j> <k>\n";
+        else
+        {
+            if(wt.range_quantile(i, j, k, ch))
+                alphabet.append_symbol(out, ch);
+
+            out += '\n';
+        }
+    }
+    else if(cmd == "count")
+    {
+        if(fieldCnt != 5 || !parse_number(field[1], i) || !parse_number(field[2], j) || !parse_symbol(field[3], lo)
+            || !parse_symbol(field[4], hi))
+            out += "ERR usage: count <i> <j> <lo> <hi>\n";
+        else
+        {
+            uint64_t codeLo = alphabet.count_less(lo);
+            uint64_t codeHi = (hi == std::numeric_limits<uint32_t>::max() ? alphabet.size() : alphabet.count_less(hi + 1));
+
+            out += std::to_string(lo <= hi && codeLo < codeHi ? wt.range_count(i, j, codeLo, codeHi - 1) : 0) + "\n";
+        }
+    }
+    else if(cmd == "next")
+    {
+        if(fieldCnt != 4 || !parse_number(field[1], i) || !parse_number(field[2], j) || !parse_symbol(field[3], lo))
+            out += "ERR usage: next <i> <j> <x>\n";
+        else
+        {
+            uint64_t code = alphabet.count_less(lo);
+
+            if(code < alphabet.size() && wt.range_next_value(i, j, code, ch))
+                alphabet.append_symbol(out, ch);
+
+            out += '\n';
+        }
+    }
+    else
+    {
+        if(fieldCnt != 4 || !parse_number(field[1], i) || !parse_number(field[2], j) || !parse_number(field[3], k))
+            out += "ERR usage: topk <i> <j> <k>\n";
+        else
+        {
+            std::vector<std::pair<uint32_t, uint64_t>> result;
+            if(least.empty() && !alphabet.is_ordered())
+                wt.least_symbols(alphabet, least);
+
+            wt.range_top_k(i, j, k, result, least.empty() ? NULL : &least);
+
+            for(uint64_t t = 0; t < result.size(); ++t)
+            {
+                if(t)
+                    out += '\t';
+
+                alphabet.append_symbol(out, result[t].first);
+                out += " " + std::to_string(result[t].second);
+            }
+
+            out += '\n';
+        }
+    }
+
+    return true;
+}
+
+
+
+template<typename T_index>
+void query_server<T_index>::process(connection &conn)
+{
+    // Answers the complete lines of the input; and, at its end, the last line even if
+    // incomplete. A line longer than MAX_REQUEST_LEN is answered by an error as soon as it is
+    // known to be, and the rest of it is discarded as it arrives; so the pending input of a
+    // client stays within READ_CHUNK + MAX_REQUEST_LEN bytes.
+
+    uint64_t start = 0;
+
+    for(uint64_t nl; (nl = conn.in.find('\n', start)) != std::string::npos; start = nl + 1)
+        if(conn.skipping)
+            conn.skipping = false;
+        else if(nl - start > MAX_REQUEST_LEN)
+            conn.out += "ERR request too long\n";
+        else
+            answer(conn.in.data() + start, conn.in.data() + nl, conn.out);
+
+    if(!conn.skipping && conn.in.size() - start > MAX_REQUEST_LEN)
+        conn.out += "ERR request too long\n", conn.skipping = true;
+
+    if(conn.skipping)
+        start = conn.in.size();
+    else if(conn.eof && start < conn.in.size())
+        answer(conn.in.data() + start, conn.in.data() + conn.in.size(), conn.out), start = conn.in.size();
+
+    conn.in.erase(0, start);
+}
+
+
+
+template<typename T_index>
+bool query_server<T_index>::write_out(connection &conn, bool blocking)
+{
+    // Writes out the pending answers; all of them if blocking, or as much as the (non-blocking)
+    // descriptor takes. Returns false if the client is gone.
+
+    uint64_t done = 0;
+
+    while(done < conn.out.size())
+    {
+        ssize_t n = write(conn.outFd, conn.out.data() + done, conn.out.size() - done);
+
+        if(n > 0)
+            done += n;
+        else if(n < 0 && errno == EINTR)
+            continue;
+        else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !blocking)
+            break;
+        else
+            return false;
+    }
+
+    conn.out.erase(0, done);
+
+    return true;
+}
+
+
+
+template<typename T_index>
+void query_server<T_index>::serve_stream(int inFd, int outFd)
+{
+    connection conn = {inFd, outFd, std::string(), std::string(), false, false};
+    std::vector<char> buf(READ_CHUNK);
+
+    while(!conn.eof)
+    {
+        ssize_t n = read(conn.inFd, buf.data(), buf.size());
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        if(n > 0)
+            conn.in.append(buf.data(), n);
+        else
+            conn.eof = true;
+
+        process(conn);
+
+        if(!write_out(conn, true))
+            return;
+    }
+}
+
+
+
+template<typename T_index>
+bool query_server<T_index>::serve_socket(const std::string &path)
+{
+    // A stale socket file of an earlier server is replaced; any other file is kept.
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Socket path too long: " << path << "\n";
+        return false;
+    }
+
+    strcpy(addr.sun_path, path.c_str());
+
+    struct stat st;
+    if(!stat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(listenFd < 0 || bind(listenFd, (sockaddr *)&addr, sizeof(addr)) || listen(listenFd, SOMAXCONN))
+    {
+        std::cerr << "Unable to listen on " << path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN);   // A client gone is detected by the failing write instead.
+
+
+    std::vector<connection> conns;
+    std::vector<pollfd> fds;
+    std::vector<char> buf(READ_CHUNK);
+
+    for(;;)
+    {
+        // A client with enough pending output is not read from, until it catches up.
+
+        fds.resize(conns.size() + 1);
+        fds[0].fd = listenFd, fds[0].events = POLLIN;
+
+        for(uint64_t i = 0; i < conns.size(); ++i)
+        {
+            fds[i + 1].fd = conns[i].inFd;
+            fds[i + 1].events = (!conns[i].eof && conns[i].out.size() < MAX_PENDING_OUT ? POLLIN : 0) |
+                                (conns[i].out.empty() ? 0 : POLLOUT);
+        }
+
+        if(poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+
+        for(uint64_t i = conns.size(); i-- > 0; )
+        {
+            connection &conn = conns[i];
+            bool alive = true;
+
+            if(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ssize_t n = read(conn.inFd, buf.data(), buf.size());
+
+                if(n > 0)
+                    conn.in.append(buf.data(), n);
+                else if(!n || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                    conn.eof = true;
+
+                process(conn);
+            }
+
+            if(!conn.out.empty())
+                alive = write_out(conn, false);
+
+            if(!alive || (conn.eof && conn.out.empty()))
+            {
+                close(conn.inFd);
+                conns.erase(conns.begin() + i);
+            }
+        }
+
+
+        if(fds[0].revents & POLLIN)
+            for(int fd; (fd = accept(listenFd, NULL, NULL)) >= 0; )
+            {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+
+                connection conn = {fd, fd, std::string(), std::string(), false, false};
+                conns.push_back(conn);
+            }
+    }
+}
+
+
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef RANK_SELECT_SUPPORT_H
+#define RANK_SELECT_SUPPORT_H
+
+#include<limits>
+
+#include "bit_vector.h"
+
+
+// Rank and select support with a layout fixed at compile time: superblocks of 2^SUP_BLK_SHIFT
+// bits with a 64-bit absolute count each, blocks of 2^BLK_SHIFT bits with a count relative to
+// their superblock, and samples of the position of every 2^SAMPLE_SHIFT'th one (and zero). The
+// block counts are CNT_WIDTH-bit fields, a power of two, packed in whole words; so that every
+// index computation of a query is a shift or a mask, and the in-block popcount is a loop over
+// a constant number of words, which the compiler unrolls.
+//
+// Unlike rank_support, whose block lengths and counter widths follow log n at run time, the
+// layout trades space for speed by the choice of the parameters; see the presets below.
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+class rank_select_support
+{
+    static_assert(BLK_SHIFT >= 6 && BLK_SHIFT < SUP_BLK_SHIFT && SUP_BLK_SHIFT <= 32, "Invalid block lengths.");
+
+private:
+    const static uint8_t CNT_WIDTH = (SUP_BLK_SHIFT <= 8 ? 8 : SUP_BLK_SHIFT <= 16 ? 16 : 32);  // Width of a block count.
+    const static uint8_t CNT_PER_WRD_SHIFT = (CNT_WIDTH == 8 ? 3 : CNT_WIDTH == 16 ? 2 : 1);   // log2(64 / CNT_WIDTH).
+    const static uint8_t BLK_PER_SUP_BLK_SHIFT = SUP_BLK_SHIFT - BLK_SHIFT;
+    const static uint64_t BLK_WRDS = 1ULL << (BLK_SHIFT - 6);                                   // Words of B per block.
+    const static uint64_t SCAN_BLK_LIMIT = 8;  // Max blocks to scan linearly in a select, before resorting to binary search.
+
+    bit_vector *B;  // Bitvector on which the rank and select supports are built.
+    bit_vector R_s; // Absolute count of ones before every superblock, a word each.
+    bit_vector R_b; // Count of ones before every block in its superblock, CNT_WIDTH bits each.
+    bit_vector S_1; // Positions of the (i * 2^SAMPLE_SHIFT + 1)'th ones, a word each.
+    bit_vector S_0; // Positions of the (i * 2^SAMPLE_SHIFT + 1)'th zeroes, a word each.
+
+    uint64_t bitCount;  // Number of bits in the bitvector B.
+    uint64_t oneCount;  // Number of ones in the bitvector B.
+    uint64_t blkCnt;    // Number of blocks.
+
+
+    inline uint64_t ones_before_block(uint64_t blk);
+    inline uint64_t count_before_block(uint64_t blk, bool bit);
+    inline uint64_t word(uint64_t wrdIdx, bool bit) { return bit ? B -> get_word(wrdIdx) : ~B -> get_word(wrdIdx); }
+    uint64_t select(uint64_t rank, bool bit);
+
+
+public:
+    rank_select_support() {}
+    rank_select_support(bit_vector *b) { build(b); }
+
+    void build(bit_vector *b);
+    uint64_t bitvector_len()    { return B -> get_len(); }
+    inline uint64_t rank1(uint64_t idx);
+    uint64_t rank0(uint64_t idx) { return idx - rank1(idx) + 1; }
+    uint64_t select1(uint64_t rank) { return select(rank, 1); }
+    uint64_t select0(uint64_t rank) { return select(rank, 0); }
+    inline void prefetch(uint64_t idx);
+    uint64_t overhead() { return R_s.get_len() + R_b.get_len() + S_1.get_len() + S_0.get_len(); }
+
+    void serialize(std::ofstream &output);
+    template<typename T_input> void deserialize(bit_vector *b, T_input &input);
+};
+
+
+
+// Presets, after the rank and select benchmarks (see benchmark.cpp): "fast" reads a 256-bit
+// block, i.e. at most four words, past the counts, at about 6.4% space for rank and 1.6% for
+// select; "compact" scans a 2048-bit block, for below 1% space for rank and for select each.
+
+typedef rank_select_support<16, 8, 12> rank_select_fast;
+typedef rank_select_support<16, 11, 13> rank_select_compact;
+
+
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+void rank_select_support<SUP_BLK_SHIFT, BLK_SHIFT, SAMPLE_SHIFT>::build(bit_vector *b)
+{
+    B = b;
+    bitCount = B -> get_len();
+
+    blkCnt = (bitCount + (1ULL << BLK_SHIFT) - 1) >> BLK_SHIFT;
+    uint64_t supBlkCnt = (blkCnt + (1ULL << BLK_PER_SUP_BLK_SHIFT) - 1) >> BLK_PER_SUP_BLK_SHIFT;
+
+    R_s.set_len(supBlkCnt * 64);
+    R_b.set_len(blkCnt * CNT_WIDTH);
+
+
+    // Fill the counts block by block.
+
+    uint64_t supBlkVal = 0, blkVal = 0;
+
+    for(uint64_t i = 0; i < blkCnt; ++i)
+    {
+        if(!(i & ((1ULL << BLK_PER_SUP_BLK_SHIFT) - 1)))
+        {
+            supBlkVal += blkVal, blkVal = 0;
+            R_s.set_word(i >> BLK_PER_SUP_BLK_SHIFT, supBlkVal);
+        }
+
+        R_b.set_int(i * CNT_WIDTH, CNT_WIDTH, blkVal);
+
+        blkVal += B -> popcount(i << BLK_SHIFT, std::min((i + 1) << BLK_SHIFT, bitCount));
+    }
+
+    oneCount = supBlkVal + blkVal;
+
+
+    // Sample the positions of every 2^SAMPLE_SHIFT'th one and zero, in a scan word by word.
+
+    S_1.set_len(((oneCount + (1ULL << SAMPLE_SHIFT) - 1) >> SAMPLE_SHIFT) * 64);
+    S_0.set_len(((bitCount - oneCount + (1ULL << SAMPLE_SHIFT) - 1) >> SAMPLE_SHIFT) * 64);
+
+    uint64_t rank[2] = {0, 0};
+    bit_vector *S[2] = {&S_0, &S_1};
+
+    for(uint64_t i = 0; i < B -> word_count(); ++i)
+        for(uint8_t bit = 0; bit < 2; ++bit)
+        {
+            uint64_t wrd = word(i, bit);
+            if(!bit && (i + 1) * 64 > bitCount)
+                wrd &= (1ULL << (bitCount & 63)) - 1;   // The padding bits are no zeroes of B.
+
+            uint64_t wrdRank = __builtin_popcountll(wrd);
+            uint64_t nextSmpl = (rank[bit] + (1ULL << SAMPLE_SHIFT) - 1) >> SAMPLE_SHIFT << SAMPLE_SHIFT;
+
+            for(; nextSmpl < rank[bit] + wrdRank; nextSmpl += (1ULL << SAMPLE_SHIFT))
+                S[bit] -> set_word(nextSmpl >> SAMPLE_SHIFT, i * 64 + select_in_word(wrd, nextSmpl - rank[bit]));
+
+            rank[bit] += wrdRank;
+        }
+}
+
+
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+uint64_t rank_select_support<SUP_BLK_SHIFT, BLK_SHIFT, SAMPLE_SHIFT>::ones_before_block(uint64_t blk)
+{
+    uint64_t cnt = (R_b.get_word(blk >> CNT_PER_WRD_SHIFT) >> ((blk & ((1 << CNT_PER_WRD_SHIFT) - 1)) * CNT_WIDTH))
+                    & ((1ULL << CNT_WIDTH) - 1);
+
+    return R_s.get_word(blk >> BLK_PER_SUP_BLK_SHIFT) + cnt;
+}
+
+
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+uint64_t rank_select_support<SUP_BLK_SHIFT, BLK_SHIFT, SAMPLE_SHIFT>::count_before_block(uint64_t blk, bool bit)
+{
+    uint64_t ones = ones_before_block(blk);
+
+    return bit ? ones : (blk << BLK_SHIFT) - ones;
+}
+
+
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+uint64_t rank_select_support<SUP_BLK_SHIFT, BLK_SHIFT, SAMPLE_SHIFT>::rank1(uint64_t idx)
+{
+    // The counts before the block, and the ones of the block's words up to idx; the loop has a
+    // constant trip count, and is unrolled.
+
+    uint64_t val = ones_before_block(idx >> BLK_SHIFT);
+    uint64_t firstWrd = (idx >> BLK_SHIFT) << (BLK_SHIFT - 6), lastWrd = idx >> 6;
+
+    for(uint64_t j = 0; j < BLK_WRDS - 1; ++j)
+    {
+        if(firstWrd + j == lastWrd)
+            break;
+
+        val += __builtin_popcountll(B -> get_word(firstWrd + j));
+    }
+
+    return val + __builtin_popcountll(B -> get_word(lastWrd) & (~0ULL >> (63 - (idx & 63))));
+}
+
+
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+uint64_t rank_select_support<SUP_BLK_SHIFT, BLK_SHIFT, SAMPLE_SHIFT>::select(uint64_t rank, bool bit)
+{
+    if(!rank || rank > (bit ? oneCount : bitCount - oneCount))
+        return std::numeric_limits<uint64_t>::max();
+
+
+    // The blocks of the sampled positions preceding and following the answer bound its block;
+    // find it by a scan over the block counts, or a binary search if the bound is loose.
+
+    bit_vector &S = (bit ? S_1 : S_0);
+    uint64_t smplIdx = (rank - 1) >> SAMPLE_SHIFT;
+
+    uint64_t blk = S.get_word(smplIdx) >> BLK_SHIFT;
+    uint64_t endBlk = ((smplIdx + 1) * 64 < S.get_len() ? S.get_word(smplIdx + 1) >> BLK_SHIFT : blkCnt - 1);
+
+    if(endBlk - blk > SCAN_BLK_LIMIT)
+    {
+        uint64_t low = blk + 1, high = endBlk;
+        while(low <= high)
+        {
+            uint64_t mid = (low + high) / 2;
+
+            if(count_before_block(mid, bit) < rank)
+                blk = mid, low = mid + 1;
+            else
+                high = mid - 1;
+        }
+    }
+    else
+        while(blk < endBlk && count_before_block(blk + 1, bit) < rank)
+            blk++;
+
+
+    // Scan the words of the block, and select within the word containing the answer. For the
+    // zeroes, the padding bits past the end of B are complemented to ones too; but they follow
+    // the last zero, so are never selected.
+
+    uint64_t count = count_before_block(blk, bit);
+    uint64_t wrdIdx = blk << (BLK_SHIFT - 6), wrd, wrdRank;
+
+    while(count + (wrdRank = __builtin_popcountll(wrd = word(wrdIdx, bit))) < rank)
+        count += wrdRank, wrdIdx++;
+
+    return wrdIdx * 64 + select_in_word(wrd, rank - count - 1);
+}
+
+
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+void rank_select_support<SUP_BLK_SHIFT, BLK_SHIFT, SAMPLE_SHIFT>::prefetch(uint64_t idx)
+{
+    // Prefetches the counts, and the word of B, that rank1(idx) reads.
+
+    R_s.prefetch((idx >> SUP_BLK_SHIFT) * 64);
+    R_b.prefetch((idx >> BLK_SHIFT) * CNT_WIDTH);
+    B -> prefetch(idx);
+}
+
+
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+void rank_select_support<SUP_BLK_SHIFT, BLK_SHIFT, SAMPLE_SHIFT>::serialize(std::ofstream &output)
+{
+    // Note that, bitvector *b is not being serialized; and neither is the layout, which is
+    // given by the type.
+    output.write((const char *)&bitCount, sizeof(bitCount));
+    output.write((const char *)&oneCount, sizeof(oneCount));
+    output.write((const char *)&blkCnt, sizeof(blkCnt));
+
+    R_s.serialize(output);
+    R_b.serialize(output);
+    S_1.serialize(output);
+    S_0.serialize(output);
+}
+
+
+
+template<uint8_t SUP_BLK_SHIFT, uint8_t BLK_SHIFT, uint8_t SAMPLE_SHIFT>
+template<typename T_input>
+void rank_select_support<SUP_BLK_SHIFT, BLK_SHIFT, SAMPLE_SHIFT>::deserialize(bit_vector *b, T_input &input)
+{
+    B = b;
+
+    input.read((char *)&bitCount, sizeof(bitCount));
+    input.read((char *)&oneCount, sizeof(oneCount));
+    input.read((char *)&blkCnt, sizeof(blkCnt));
+
+    R_s.deserialize(input);
+    R_b.deserialize(input);
+    S_1.deserialize(input);
+    S_0.deserialize(input);
+}
+
+
+
+#endif
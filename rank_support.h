@@ -1,12 +1,21 @@
+#ifndef RANK_SUPPORT_H
+#define RANK_SUPPORT_H
+
 #include<cmath>
+#include<algorithm>
 #include<iostream>
+#include<vector>
 
 #include "bit_vector.h"
+#include "task_pool.h"
+#include "perf_counters.h"
 
 
 class rank_support
 {
 private:
+    const static uint64_t PAR_BUILD_LEN = 1 << 22;  // Min bitvector length to build in parallel.
+
     bit_vector *B;  //  Bitvector on which the rank-support data-structure is built upon.
     bit_vector R_s; // The superblocks bitvector.
     bit_vector R_b; // The blocks bitvector.
@@ -26,23 +35,31 @@ private:
     uint8_t blkCntPerSupBlk;    // log n
 
 
+    void set_layout(uint64_t bitCount);
+    void serialize_layout(std::ofstream &output);
     inline void set_superblock_value(uint64_t idx, uint64_t val);
     inline void set_block_value(uint64_t supBlkIdx, uint8_t blkIdx, uint64_t val);
+    void fill_superblocks(uint64_t first, uint64_t last, uint64_t supBlkVal);
     void dump_metadata();
 
+    friend class stream_builder;
+
 
 public:
     rank_support() {}
     rank_support(bit_vector *b);
 
-    void build(bit_vector *b);
+    void build(bit_vector *b, task_pool *pool = NULL);
+    void extend();
     uint64_t bitvector_len()    { return B -> get_len(); }
+    bit_vector *bitvector()     { return B; }
     uint64_t rank1(uint64_t idx);
     uint64_t rank0(uint64_t idx);
+    inline void prefetch(uint64_t idx);
     uint64_t overhead();
 
     void serialize(std::ofstream &output);
-    void deserialize(bit_vector *b, std::ifstream &input);
+    template<typename T_input> void deserialize(bit_vector *b, T_input &input);
 };
 
 
@@ -54,50 +71,127 @@ rank_support::rank_support(bit_vector *b)
 
 
 
-void rank_support::build(bit_vector *b)
+void rank_support::build(bit_vector *b, task_pool *pool)
 {
     B = b;
-    bitCount = B -> get_len();
+    set_layout(B -> get_len());
+
+    R_s.set_len(supBlkCnt * supBlkWrdSz);
+    R_b.set_len((supBlkCnt * blkCntPerSupBlk) * blkWrdSz);
+
+    // dump_metadata();
+
+
+    // With a pool, the superblocks are filled in parallel chunks, after a prefix sum over
+    // the one-counts of the chunks. Every chunk spans a multiple of 64 superblocks; thus
+    // covers whole words of R_s and R_b, and the chunks do not share any word.
+
+    if(!pool || bitCount < PAR_BUILD_LEN)
+    {
+        fill_superblocks(0, supBlkCnt, 0);
+        return;
+    }
+
+    uint64_t chunkCnt = pool -> thread_count() * 4;
+    uint64_t chunkLen = ((supBlkCnt + chunkCnt - 1) / chunkCnt + 63) / 64 * 64;
+    chunkCnt = (supBlkCnt + chunkLen - 1) / chunkLen;
+
+    std::vector<uint64_t> chunkVal(chunkCnt + 1, 0);
+
+    pool -> parallel_for(chunkCnt, [&](uint64_t c)
+        {
+            chunkVal[c + 1] = B -> popcount(c * chunkLen * supBlkLen, std::min((c + 1) * chunkLen * supBlkLen, bitCount));
+        });
+
+    for(uint64_t c = 0; c < chunkCnt; ++c)
+        chunkVal[c + 1] += chunkVal[c];
+
+    pool -> parallel_for(chunkCnt, [&](uint64_t c)
+        {
+            fill_superblocks(c * chunkLen, std::min((c + 1) * chunkLen, supBlkCnt), chunkVal[c]);
+        });
+}
+
+
+
+void rank_support::extend()
+{
+    // Extends the directories over the bits appended to B since they were built. The layout is
+    // kept as long as the superblock values fit in their words, i.e. until the length doubles;
+    // only the superblocks from the last (partial) one on are filled then. Otherwise they are
+    // rebuilt for the new length; thus appending a bit takes O(1) amortized time.
+
+    uint64_t newCount = B -> get_len();
+
+    if(newCount <= bitCount)
+        return;
+
+    if(supBlkWrdSz < 64 && newCount > (1ULL << supBlkWrdSz))
+    {
+        build(B);
+        return;
+    }
+
+    uint64_t first = bitCount / supBlkLen;
+    uint64_t supBlkVal = (first ? rank1(first * supBlkLen - 1) : 0);
+
+    bitCount = newCount;
+    supBlkCnt = ceil(double(bitCount) / supBlkLen);
+
+    R_s.resize(supBlkCnt * supBlkWrdSz);
+    R_b.resize((supBlkCnt * blkCntPerSupBlk) * blkWrdSz);
+
+    fill_superblocks(first, supBlkCnt, supBlkVal);
+}
+
 
-    supBlkLen = ceil(pow(log2(bitCount), 2) / 2);
-    supBlkWrdSz = ceil(log2(bitCount));
+
+void rank_support::set_layout(uint64_t bitCount)
+{
+    // Sets the superblock and block dimensions for a bitvector of bitCount bits.
+
+    this -> bitCount = bitCount;
+
+    double logLen = log2(std::max<uint64_t>(bitCount, 2));  // Avoids empty blocks for tiny bitvectors.
+
+    supBlkLen = ceil(pow(logLen, 2) / 2);
+    supBlkWrdSz = ceil(logLen);
     supBlkCnt = ceil(double(bitCount) / supBlkLen);
 
-    blkLen = ceil(log2(bitCount) / 2);
+    blkLen = ceil(logLen / 2);
     blkWrdSz = ceil(log2(supBlkLen));
     blkCntPerSupBlk = ceil(double(supBlkLen) / blkLen);
+}
 
 
-    R_s.set_len(supBlkCnt * supBlkWrdSz);
-    R_b.set_len((supBlkCnt * blkCntPerSupBlk) * blkWrdSz);
 
-    // dump_metadata();
+void rank_support::fill_superblocks(uint64_t first, uint64_t last, uint64_t supBlkVal)
+{
+    // Fills the superblocks [first, last) and their blocks, with supBlkVal ones preceding.
+    // A block spans at most 32 bits; so its ones are counted with one get_int and popcount.
 
-    uint64_t supBlkVal = 0;
-    for(uint64_t i = 0; i < supBlkCnt; ++i)
+    for(uint64_t i = first; i < last; ++i)
     {
         set_superblock_value(i, supBlkVal);
 
         // printf("R_s[%d] = %d\n", (int)i, (int)supBlkVal);
 
+        uint64_t supBlkEnd = std::min((i + 1) * supBlkLen, bitCount);
         uint64_t blkVal = 0;
+
         for(uint8_t j = 0; j < blkCntPerSupBlk; ++j)
         {
             set_block_value(i, j, blkVal);
 
             // printf("R_b[%d][%d] = %d\n", (int)i, (int)j, (int)blkVal);
-            
-            uint64_t bitOffset = i * supBlkLen + j * blkLen;
-            // printf("bitOffset = %d\n", (int)bitOffset);
 
-            for(uint8_t k = 0; k < blkLen && (bitOffset + k) < (i + 1) * supBlkLen && (bitOffset + k) < bitCount; ++k)
-            {
-                // printf("bit_%d = %d\n", (int)(bitOffset + k), B -> get_bit(bitOffset + k));
+            uint64_t bitOffset = i * supBlkLen + j * blkLen;
 
-                if(B -> get_bit(bitOffset + k))
-                    blkVal++, supBlkVal++;
-            }
+            if(bitOffset < supBlkEnd)
+                blkVal += __builtin_popcountll(B -> get_int(bitOffset, std::min<uint64_t>(blkLen, supBlkEnd - bitOffset)));
         }
+
+        supBlkVal += blkVal;
     }
 }
 
@@ -135,6 +229,8 @@ void rank_support::set_block_value(uint64_t supBlkIdx, uint8_t blkIdx, uint64_t
 
 uint64_t rank_support::rank1(uint64_t idx)
 {
+    count_rank_call();
+
     uint64_t supBlk = idx / supBlkLen;
     uint8_t blk = (idx % supBlkLen) / blkLen;
     uint8_t inBlkBit = (idx - (supBlk * supBlkLen + (uint64_t)blk * blkLen));
@@ -142,13 +238,27 @@ uint64_t rank_support::rank1(uint64_t idx)
 
     uint64_t supBlkVal = R_s.get_int(supBlk * supBlkWrdSz, supBlkWrdSz);
     uint64_t blkVal = R_b.get_int((supBlk * blkCntPerSupBlk + blk) * blkWrdSz, blkWrdSz);
-    uint64_t inBlkVal = __builtin_popcount(B -> get_int(supBlk * supBlkLen + (uint64_t)blk * blkLen, inBlkBit + 1));
+    uint64_t inBlkVal = __builtin_popcountll(B -> get_int(supBlk * supBlkLen + (uint64_t)blk * blkLen, inBlkBit + 1));
 
     return  supBlkVal + blkVal + inBlkVal;
 }
 
 
 
+void rank_support::prefetch(uint64_t idx)
+{
+    // Prefetches the superblock and block values, and the word of B, that rank1(idx) reads.
+
+    uint64_t supBlk = idx / supBlkLen;
+    uint8_t blk = (idx % supBlkLen) / blkLen;
+
+    R_s.prefetch(supBlk * supBlkWrdSz);
+    R_b.prefetch((supBlk * blkCntPerSupBlk + blk) * blkWrdSz);
+    B -> prefetch(idx);
+}
+
+
+
 uint64_t rank_support::rank0(uint64_t idx)
 {
     return idx - rank1(idx) + 1;
@@ -163,10 +273,8 @@ uint64_t rank_support::overhead()
 
 
 
-void rank_support::serialize(std::ofstream &output)
+void rank_support::serialize_layout(std::ofstream &output)
 {
-    // Serialize the metadata.
-
     output.write((const char *)&bitCount, sizeof(bitCount));
 
     output.write((const char *)&supBlkLen, sizeof(supBlkLen));
@@ -176,6 +284,14 @@ void rank_support::serialize(std::ofstream &output)
     output.write((const char *)&blkLen, sizeof(blkLen));
     output.write((const char *)&blkWrdSz, sizeof(blkWrdSz));
     output.write((const char *)&blkCntPerSupBlk, sizeof(blkCntPerSupBlk));
+}
+
+
+
+void rank_support::serialize(std::ofstream &output)
+{
+    // Serialize the metadata.
+    serialize_layout(output);
 
 
     // Serialize the R_s and R_b bitvectors.
@@ -187,7 +303,8 @@ void rank_support::serialize(std::ofstream &output)
 
 
 
-void rank_support::deserialize(bit_vector *b, std::ifstream &input)
+template<typename T_input>
+void rank_support::deserialize(bit_vector *b, T_input &input)
 {
     B = b;
 
@@ -204,3 +321,7 @@ void rank_support::deserialize(bit_vector *b, std::ifstream &input)
     R_s.deserialize(input);
     R_b.deserialize(input);
 }
+
+
+
+#endif
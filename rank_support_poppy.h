@@ -0,0 +1,169 @@
+#ifndef RANK_SUPPORT_POPPY_H
+#define RANK_SUPPORT_POPPY_H
+
+#include<iostream>
+
+#include "bit_vector.h"
+
+
+// Cache-conscious rank-support in the layout of "poppy" (Zhou, Andersen and Kaminsky, 2013).
+// The bitvector is split into basic blocks of 512 bits, i.e. one 64-byte cache line each.
+// For every run of four basic blocks (2048 bits), one 64-bit entry interleaves the absolute
+// count before the run (lower 32 bits) with the counts of its first three basic blocks
+// (10 bits each); so a rank query reads one directory word and one line of the bitvector.
+// The 32-bit absolute counts are relative to a 64-bit count stored per 2^32 bits.
+
+class rank_support_poppy
+{
+private:
+    const static uint64_t BASIC_BLK_LEN = 512;        // Bits per basic block.
+    const static uint8_t BASIC_BLK_SHIFT = 9;
+    const static uint64_t ENTRY_LEN = 2048;           // Bits covered per interleaved entry.
+    const static uint8_t ENTRY_SHIFT = 11;
+    const static uint8_t L0_SHIFT = 32;               // Bits covered per absolute count: 2^32.
+    const static uint8_t L2_WRD_SZ = 10;              // Width of the basic block counts.
+
+    bit_vector *B;  // Bitvector on which the rank-support data-structure is built upon.
+    bit_vector L0;  // 64-bit absolute counts, one per 2^32 bits.
+    bit_vector L12; // Interleaved 64-bit entries, one per 2048 bits.
+
+    uint64_t bitCount;  // Number of bits in the bitvector B.
+
+
+public:
+    rank_support_poppy() {}
+    rank_support_poppy(bit_vector *b);
+
+    void build(bit_vector *b);
+    uint64_t bitvector_len()    { return B -> get_len(); }
+    uint64_t rank1(uint64_t idx);
+    uint64_t rank0(uint64_t idx);
+    inline void prefetch(uint64_t idx);
+    uint64_t overhead();
+
+    void serialize(std::ofstream &output);
+    template<typename T_input> void deserialize(bit_vector *b, T_input &input);
+};
+
+
+
+rank_support_poppy::rank_support_poppy(bit_vector *b)
+{
+    build(b);
+}
+
+
+
+void rank_support_poppy::build(bit_vector *b)
+{
+    B = b;
+    bitCount = B -> get_len();
+
+    uint64_t entryCnt = (bitCount + ENTRY_LEN - 1) / ENTRY_LEN;
+    uint64_t l0Cnt = (bitCount >> L0_SHIFT) + 1;
+
+    L0.set_len(l0Cnt * 64);
+    L12.set_len(entryCnt * 64);
+
+
+    uint64_t absVal = 0, l0Val = 0;
+
+    for(uint64_t i = 0; i < entryCnt; ++i)
+    {
+        if(!((i << ENTRY_SHIFT) & ((1ULL << L0_SHIFT) - 1)))
+        {
+            l0Val = absVal;
+            L0.set_word((i << ENTRY_SHIFT) >> L0_SHIFT, l0Val);
+        }
+
+        uint64_t entry = absVal - l0Val;
+
+        for(uint8_t j = 0; j < ENTRY_LEN / BASIC_BLK_LEN; ++j)
+        {
+            uint64_t blkStart = (i << ENTRY_SHIFT) + (j << BASIC_BLK_SHIFT);
+            uint64_t blkVal = B -> popcount(std::min(blkStart, bitCount), std::min(blkStart + BASIC_BLK_LEN, bitCount));
+
+            if(j < ENTRY_LEN / BASIC_BLK_LEN - 1)
+                entry |= (blkVal << (32 + j * L2_WRD_SZ));
+
+            absVal += blkVal;
+        }
+
+        L12.set_word(i, entry);
+    }
+}
+
+
+
+uint64_t rank_support_poppy::rank1(uint64_t idx)
+{
+    uint64_t entry = L12.get_word(idx >> ENTRY_SHIFT);
+    uint64_t val = L0.get_word(idx >> L0_SHIFT) + (entry & 0xFFFFFFFF);
+
+    uint8_t blk = (idx >> BASIC_BLK_SHIFT) & 3;
+    for(uint8_t j = 0; j < blk; ++j)
+        val += (entry >> (32 + j * L2_WRD_SZ)) & ((1 << L2_WRD_SZ) - 1);
+
+    uint64_t wrdIdx = (idx >> BASIC_BLK_SHIFT) << (BASIC_BLK_SHIFT - 6);
+    uint64_t lastWrd = idx >> 6;
+    for(; wrdIdx < lastWrd; ++wrdIdx)
+        val += __builtin_popcountll(B -> get_word(wrdIdx));
+
+    uint8_t inWrdBit = idx & 63;
+    uint64_t mask = (inWrdBit == 63 ? ~0ULL : (1ULL << (inWrdBit + 1)) - 1);
+
+    return val + __builtin_popcountll(B -> get_word(lastWrd) & mask);
+}
+
+
+
+void rank_support_poppy::prefetch(uint64_t idx)
+{
+    // Prefetches the interleaved entry, and the basic block's line of B, that rank1(idx) reads.
+
+    L12.prefetch(idx >> ENTRY_SHIFT << 6);
+    B -> prefetch(idx);
+}
+
+
+
+uint64_t rank_support_poppy::rank0(uint64_t idx)
+{
+    return idx - rank1(idx) + 1;
+}
+
+
+
+uint64_t rank_support_poppy::overhead()
+{
+    return L0.get_len() + L12.get_len();
+}
+
+
+
+void rank_support_poppy::serialize(std::ofstream &output)
+{
+    // Note that, bitvector *b is not being serialized; handle this issue carefully
+    // while deserializing.
+    output.write((const char *)&bitCount, sizeof(bitCount));
+
+    L0.serialize(output);
+    L12.serialize(output);
+}
+
+
+
+template<typename T_input>
+void rank_support_poppy::deserialize(bit_vector *b, T_input &input)
+{
+    B = b;
+
+    input.read((char *)&bitCount, sizeof(bitCount));
+
+    L0.deserialize(input);
+    L12.deserialize(input);
+}
+
+
+
+#endif
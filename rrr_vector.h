@@ -0,0 +1,316 @@
+#ifndef RRR_VECTOR_H
+#define RRR_VECTOR_H
+
+#include<limits>
+
+#include "bit_vector.h"
+
+
+// Compressed bitvector of Raman, Raman and Rao (2002): the bits are split into blocks of
+// BLOCK_LEN bits; each block is stored as its class (number of ones), and its offset (the
+// index of the block among the blocks of its class, in enumerative order) in the minimum bit
+// width for the class. Thus the blocks of a biased bitvector take far fewer bits than their
+// length, totaling about nH0 bits plus the classes. Every SAMPLE_BLOCKS blocks, the rank before
+// the block and the position of its offset are sampled; a rank, select or access query reads a
+// sample, sums the classes (and offset widths) of up to SAMPLE_BLOCKS - 1 blocks, and decodes
+// one block.
+
+class rrr_vector
+{
+private:
+    const static uint8_t BLOCK_LEN = 63;        // Bits per block; any C(63, k) fits in 63 bits.
+    const static uint8_t CLASS_WRD_SZ = 6;      // Bit-length for each block class.
+    const static uint64_t SAMPLE_BLOCKS = 32;   // Blocks per sample.
+
+    uint64_t len;       // Number of bits.
+    uint64_t oneCount;  // Number of ones.
+    bit_vector C;       // Class of each block.
+    bit_vector O;       // Offset of each block.
+    bit_vector S;       // Per sample, the ones before its first block, and the position of its offset in O.
+
+
+    struct tables
+    {
+        uint64_t binom[BLOCK_LEN + 1][BLOCK_LEN + 1];   // binom[n][k] = C(n, k); 0 for k > n.
+        uint8_t width[BLOCK_LEN + 1];                   // Bit-length for the offsets of each class.
+
+        tables();
+    };
+
+    static const tables &table() { static const tables t; return t; }
+
+    static uint64_t encode(uint64_t block, uint8_t k);
+    static uint64_t decode(uint64_t offset, uint8_t k, uint8_t limit = BLOCK_LEN);
+    inline uint8_t block_class(uint64_t blkIdx) { return C.get_int(blkIdx * CLASS_WRD_SZ, CLASS_WRD_SZ); }
+    inline uint64_t block(uint64_t blkIdx, uint8_t limit, uint64_t &rank);
+    uint64_t select(uint64_t rank, bool bit);
+
+
+public:
+    rrr_vector() { len = oneCount = 0; }
+
+    void build(bit_vector &B);
+    uint64_t get_len() { return len; }
+    bool get_bit(uint64_t idx);
+    uint64_t rank1(uint64_t idx);
+    uint64_t rank0(uint64_t idx) { return idx - rank1(idx) + 1; }
+    uint64_t access_rank(uint64_t idx, bool &bit);
+    uint64_t select1(uint64_t rank) { return select(rank, 1); }
+    uint64_t select0(uint64_t rank) { return select(rank, 0); }
+    inline void prefetch(uint64_t idx);
+    uint64_t size_in_bits() { return C.get_len() + O.get_len() + S.get_len(); }
+
+    void serialize(std::ofstream &output);
+    template<typename T_input> void deserialize(T_input &input);
+};
+
+
+
+rrr_vector::tables::tables()
+{
+    for(uint8_t n = 0; n <= BLOCK_LEN; ++n)
+        for(uint8_t k = 0; k <= BLOCK_LEN; ++k)
+            binom[n][k] = (k > n ? 0 : !k || k == n ? 1 : binom[n - 1][k - 1] + binom[n - 1][k]);
+
+    for(uint8_t k = 0; k <= BLOCK_LEN; ++k)
+    {
+        width[k] = 0;
+        while(width[k] < 64 && (1ULL << width[k]) < binom[BLOCK_LEN][k])
+            width[k]++;
+    }
+}
+
+
+
+uint64_t rrr_vector::encode(uint64_t block, uint8_t k)
+{
+    // The blocks of class k are ordered lexicographically from bit 0 on; a one at bit i is
+    // preceded by the C(BLOCK_LEN - i - 1, k) blocks with a zero there and the same bits before.
+
+    const tables &t = table();
+    uint64_t offset = 0;
+
+    for(uint8_t i = 0; k; ++i)
+        if((block >> i) & 1)
+            offset += t.binom[BLOCK_LEN - i - 1][k], k--;
+
+    return offset;
+}
+
+
+
+uint64_t rrr_vector::decode(uint64_t offset, uint8_t k, uint8_t limit)
+{
+    // Decodes the first limit bits of the block; without branches on the bits, which are
+    // unpredictable.
+
+    const tables &t = table();
+    uint64_t block = 0;
+
+    for(uint8_t i = 0; i < limit && k; ++i)
+    {
+        uint64_t c = t.binom[BLOCK_LEN - i - 1][k];
+        uint64_t one = (offset >= c);
+
+        block |= one << i;
+        offset -= c & -one;
+        k -= one;
+    }
+
+    return block;
+}
+
+
+
+void rrr_vector::build(bit_vector &B)
+{
+    // Two passes over the blocks: the classes give the length of the offsets; and then the
+    // offsets and the samples are written.
+
+    const tables &t = table();
+
+    len = B.get_len();
+
+    uint64_t blkCnt = (len + BLOCK_LEN - 1) / BLOCK_LEN;
+    uint64_t offsetBits = 0;
+
+    C.set_len(blkCnt * CLASS_WRD_SZ);
+
+    for(uint64_t i = 0; i < blkCnt; ++i)
+    {
+        uint8_t k = __builtin_popcountll(B.get_int(i * BLOCK_LEN, std::min<uint64_t>(BLOCK_LEN, len - i * BLOCK_LEN)));
+
+        C.set_int(i * CLASS_WRD_SZ, CLASS_WRD_SZ, k);
+        offsetBits += t.width[k];
+    }
+
+
+    O.set_len(offsetBits);
+    S.set_len(((blkCnt + SAMPLE_BLOCKS - 1) / SAMPLE_BLOCKS) * 128);
+
+    uint64_t rank = 0, pos = 0;
+
+    for(uint64_t i = 0; i < blkCnt; ++i)
+    {
+        if(i % SAMPLE_BLOCKS == 0)
+            S.set_word(i / SAMPLE_BLOCKS * 2, rank), S.set_word(i / SAMPLE_BLOCKS * 2 + 1, pos);
+
+        uint8_t k = block_class(i);
+        uint64_t bits = B.get_int(i * BLOCK_LEN, std::min<uint64_t>(BLOCK_LEN, len - i * BLOCK_LEN));
+
+        O.set_int(pos, t.width[k], encode(bits, k));
+        rank += k, pos += t.width[k];
+    }
+
+    oneCount = rank;
+}
+
+
+
+uint64_t rrr_vector::block(uint64_t blkIdx, uint8_t limit, uint64_t &rank)
+{
+    // Decodes the first limit bits of the block; and sets rank to the number of ones before it.
+
+    const tables &t = table();
+    uint64_t smplIdx = blkIdx / SAMPLE_BLOCKS;
+    uint64_t pos = S.get_word(smplIdx * 2 + 1);
+
+    rank = S.get_word(smplIdx * 2);
+
+    for(uint64_t i = smplIdx * SAMPLE_BLOCKS; i < blkIdx; ++i)
+    {
+        uint8_t k = block_class(i);
+        rank += k, pos += t.width[k];
+    }
+
+    uint8_t k = block_class(blkIdx);
+
+    return decode(O.get_int(pos, t.width[k]), k, limit);
+}
+
+
+
+bool rrr_vector::get_bit(uint64_t idx)
+{
+    uint64_t rank;
+
+    return (block(idx / BLOCK_LEN, idx % BLOCK_LEN + 1, rank) >> (idx % BLOCK_LEN)) & 1;
+}
+
+
+
+uint64_t rrr_vector::rank1(uint64_t idx)
+{
+    // Returns the number of ones in [0, idx].
+
+    uint64_t rank, bits = block(idx / BLOCK_LEN, idx % BLOCK_LEN + 1, rank);
+
+    return rank + __builtin_popcountll(bits);
+}
+
+
+
+uint64_t rrr_vector::access_rank(uint64_t idx, bool &bit)
+{
+    // Returns rank1(idx), and sets bit to the bit at idx; from a single decoding of the block,
+    // rather than one for get_bit and one for rank1.
+
+    uint64_t rank, bits = block(idx / BLOCK_LEN, idx % BLOCK_LEN + 1, rank);
+
+    bit = (bits >> (idx % BLOCK_LEN)) & 1;
+    return rank + __builtin_popcountll(bits);
+}
+
+
+
+uint64_t rrr_vector::select(uint64_t rank, bool bit)
+{
+    if(!rank || rank > (bit ? oneCount : len - oneCount))
+        return std::numeric_limits<uint64_t>::max();
+
+
+    // Binary search for the last sample with fewer than rank queried bits before it.
+
+    const tables &t = table();
+    uint64_t smplCnt = S.get_len() / 128;
+    uint64_t low = 0, high = smplCnt - 1;
+
+    auto count_before = [&](uint64_t smplIdx)
+        {
+            uint64_t ones = S.get_word(smplIdx * 2);
+            return bit ? ones : smplIdx * SAMPLE_BLOCKS * BLOCK_LEN - ones;
+        };
+
+    while(low < high)
+    {
+        uint64_t mid = (low + high + 1) / 2;
+
+        if(count_before(mid) < rank)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+
+
+    // Scan the sample's blocks for the one holding the answer, and select within it.
+
+    uint64_t count = count_before(low), pos = S.get_word(low * 2 + 1);
+    uint64_t blkIdx = low * SAMPLE_BLOCKS;
+    uint8_t k;
+
+    for(; ; ++blkIdx)
+    {
+        k = block_class(blkIdx);
+
+        uint64_t blkCount = (bit ? k : BLOCK_LEN - k);
+        if(count + blkCount >= rank)
+            break;
+
+        count += blkCount, pos += t.width[k];
+    }
+
+    uint64_t bits = decode(O.get_int(pos, t.width[k]), k);
+
+    return blkIdx * BLOCK_LEN + select_in_word(bit ? bits : ~bits, rank - count - 1);
+}
+
+
+
+void rrr_vector::prefetch(uint64_t idx)
+{
+    // Prefetches the sample, and the first class, that a query at idx reads.
+
+    uint64_t blkIdx = idx / BLOCK_LEN;
+
+    S.prefetch(blkIdx / SAMPLE_BLOCKS * 128);
+    C.prefetch(blkIdx / SAMPLE_BLOCKS * SAMPLE_BLOCKS * CLASS_WRD_SZ);
+}
+
+
+
+void rrr_vector::serialize(std::ofstream &output)
+{
+    output.write((const char *)&len, sizeof(len));
+    output.write((const char *)&oneCount, sizeof(oneCount));
+
+    C.serialize(output);
+    O.serialize(output);
+    S.serialize(output);
+}
+
+
+
+template<typename T_input>
+void rrr_vector::deserialize(T_input &input)
+{
+    input.read((char *)&len, sizeof(len));
+    input.read((char *)&oneCount, sizeof(oneCount));
+
+    C.deserialize(input);
+    O.deserialize(input);
+    S.deserialize(input);
+}
+
+
+
+#endif
@@ -1,54 +1,204 @@
+#ifndef SELECT_SUPPORT_H
+#define SELECT_SUPPORT_H
+
+#include<limits>
+
 #include "rank_support.h"
 
 
 class select_support
 {
     private:
+        const static uint64_t SAMPLE_RATE = 1024;   // Every SAMPLE_RATE'th one (and zero) is sampled.
+        const static uint64_t SCAN_WRD_LIMIT = 64;  // Max words to scan linearly before resorting to rank.
+
         rank_support *r;    // Rank support on which this select support functions.
+        bit_vector *B;      // Bitvector underlying the rank support.
 
+        uint64_t oneCount;  // Number of ones in the bitvector B.
+        uint8_t smplWrdSz;  // Bit-length of each sampled position.
+        bit_vector S_1;     // Positions of the (i * SAMPLE_RATE + 1)'th ones.
+        bit_vector S_0;     // Positions of the (i * SAMPLE_RATE + 1)'th zeroes.
+
+        inline uint64_t word(uint64_t wrdIdx, bool bit);
+        inline uint64_t count_before_word(uint64_t wrdIdx, bool bit);
         uint64_t select(uint64_t rank, bool bit);
+        void sample(uint64_t firstWrd, uint64_t ones, uint64_t zeroes);
+        static uint8_t sample_width(uint64_t bitCount) { return std::max(1.0, ceil(log2(bitCount + 1))); }
+
+        friend class stream_builder;
 
     public:
         select_support() {}
         select_support(rank_support *R) { build(R); }
 
-        void build(rank_support *R) { r = R; }
+        void build(rank_support *R);
+        void extend(uint64_t oldLen);
         uint64_t select1(uint64_t rank);
         uint64_t select0(uint64_t rank);
+        inline void prefetch(uint64_t rank, bool bit);
         uint64_t overhead();
+
+        void serialize(std::ofstream &output);
+        template<typename T_input> void deserialize(rank_support *R, T_input &input);
 };
 
 
 
+void select_support::build(rank_support *R)
+{
+    r = R;
+    B = r -> bitvector();
+
+    uint64_t bitCount = B -> get_len();
+
+    oneCount = (bitCount ? r -> rank1(bitCount - 1) : 0);
+    smplWrdSz = sample_width(bitCount);
+
+    S_1.set_len(((oneCount + SAMPLE_RATE - 1) / SAMPLE_RATE) * smplWrdSz);
+    S_0.set_len(((bitCount - oneCount + SAMPLE_RATE - 1) / SAMPLE_RATE) * smplWrdSz);
+
+    sample(0, 0, 0);
+}
+
+
+
+void select_support::extend(uint64_t oldLen)
+{
+    // Samples the ones and zeroes appended to B (and to its rank support) since the first oldLen
+    // bits, resuming the scan at the word of the first new bit. The sample width is kept until
+    // the length doubles; the samples are rebuilt then, in O(1) amortized time per appended bit.
+
+    uint64_t bitCount = B -> get_len();
+
+    if(sample_width(bitCount) != smplWrdSz)
+    {
+        build(r);
+        return;
+    }
+
+    uint64_t wrdIdx = oldLen / 64;
+    uint64_t onesBefore = oneCount - B -> popcount(wrdIdx * 64, oldLen);
+
+    oneCount = (bitCount ? r -> rank1(bitCount - 1) : 0);
+
+    S_1.resize(((oneCount + SAMPLE_RATE - 1) / SAMPLE_RATE) * smplWrdSz);
+    S_0.resize(((bitCount - oneCount + SAMPLE_RATE - 1) / SAMPLE_RATE) * smplWrdSz);
+
+    sample(wrdIdx, onesBefore, wrdIdx * 64 - onesBefore);
+}
+
+
+
+void select_support::sample(uint64_t firstWrd, uint64_t ones, uint64_t zeroes)
+{
+    // Scan the bitvector word by word from firstWrd on, preceded by the given counts of ones
+    // and zeroes; and record the position of a one (zero) whenever the one-count (zero-count)
+    // reaches the next sampled rank.
+
+    uint64_t wrdCnt = B -> word_count();
+    uint64_t rank[2] = {zeroes, ones};
+    bit_vector *S[2] = {&S_0, &S_1};
+
+    for(uint64_t i = firstWrd; i < wrdCnt; ++i)
+        for(uint8_t bit = 0; bit < 2; ++bit)
+        {
+            uint64_t wrd = word(i, bit);
+            uint64_t wrdRank = __builtin_popcountll(wrd);
+
+            uint64_t nextSmpl = (rank[bit] + SAMPLE_RATE - 1) / SAMPLE_RATE * SAMPLE_RATE;
+            while(nextSmpl < rank[bit] + wrdRank)
+            {
+                uint64_t pos = i * 64 + select_in_word(wrd, nextSmpl - rank[bit]);
+                S[bit] -> set_int((nextSmpl / SAMPLE_RATE) * smplWrdSz, smplWrdSz, pos);
+
+                nextSmpl += SAMPLE_RATE;
+            }
+
+            rank[bit] += wrdRank;
+        }
+}
+
+
+
+uint64_t select_support::word(uint64_t wrdIdx, bool bit)
+{
+    // Returns the word at index wrdIdx of B, with the bits of interest set; the zeroes
+    // are complemented, with the padding bits after the end of B masked off.
+
+    uint64_t wrd = B -> get_word(wrdIdx);
+    if(bit)
+        return wrd;
+
+    uint64_t bitCount = B -> get_len();
+    if((wrdIdx + 1) * 64 > bitCount)
+        return ~wrd & ((1ULL << (bitCount & 63)) - 1);
+
+    return ~wrd;
+}
+
+
+
+uint64_t select_support::count_before_word(uint64_t wrdIdx, bool bit)
+{
+    if(!wrdIdx)
+        return 0;
+
+    return bit ? r -> rank1(wrdIdx * 64 - 1) : r -> rank0(wrdIdx * 64 - 1);
+}
+
+
+
 uint64_t select_support::select(uint64_t rank, bool bit)
 {
-    if(!rank || rank > r -> bitvector_len())
+    if(!rank || rank > (bit ? oneCount : B -> get_len() - oneCount))
         return std::numeric_limits<uint64_t>::max();
 
-    uint64_t low = 0, high = r -> bitvector_len() - 1, mid, soln;
 
-    soln = std::numeric_limits<uint64_t>::max();
-    while(low <= high)
+    // Locate the word containing the nearest sampled position preceding the answer, and
+    // the count of the queried bit before that word.
+
+    bit_vector &S = (bit ? S_1 : S_0);
+    uint64_t smplIdx = (rank - 1) / SAMPLE_RATE;
+    uint64_t smplPos = S.get_int(smplIdx * smplWrdSz, smplWrdSz);
+
+    uint64_t wrdIdx = smplPos / 64;
+    uint64_t count = smplIdx * SAMPLE_RATE - __builtin_popcountll(word(wrdIdx, bit) & ((1ULL << (smplPos & 63)) - 1));
+
+
+    // If the next sample is far apart (i.e. a sparse region), narrow down the word
+    // with a binary search over the rank support.
+
+    uint64_t endWrdIdx = B -> word_count() - 1;
+    if((smplIdx + 1) * smplWrdSz < S.get_len())
+        endWrdIdx = S.get_int((smplIdx + 1) * smplWrdSz, smplWrdSz) / 64;
+
+    if(endWrdIdx - wrdIdx > SCAN_WRD_LIMIT)
     {
-        mid = (low + high) / 2;
-        uint64_t rankMid = (bit ? r -> rank1(mid) : r -> rank0(mid));
-
-        if(rankMid < rank)
-            low = mid + 1;
-        else if(rankMid > rank)
-            high = mid - 1;
-        else
+        uint64_t low = wrdIdx + 1, high = endWrdIdx;
+        while(low <= high)
         {
-            soln = mid;
+            uint64_t mid = (low + high) / 2;
+            uint64_t countMid = count_before_word(mid, bit);
 
-            if(mid > 0)
-                high = mid - 1;
+            if(countMid < rank)
+                wrdIdx = mid, count = countMid, low = mid + 1;
             else
-                break;
+                high = mid - 1;
         }
     }
 
-    return soln;
+
+    // Scan the words linearly, and select within the word containing the answer.
+
+    uint64_t wrd = word(wrdIdx, bit), wrdRank;
+    while(count + (wrdRank = __builtin_popcountll(wrd)) < rank)
+    {
+        count += wrdRank;
+        wrd = word(++wrdIdx, bit);
+    }
+
+    return wrdIdx * 64 + select_in_word(wrd, rank - count - 1);
 }
 
 
@@ -67,7 +217,49 @@ uint64_t select_support::select0(uint64_t rank)
 
 
 
+void select_support::prefetch(uint64_t rank, bool bit)
+{
+    // Prefetches the sampled position that select(rank, bit) starts from.
+
+    if(rank)
+        (bit ? S_1 : S_0).prefetch(((rank - 1) / SAMPLE_RATE) * smplWrdSz);
+}
+
+
+
 uint64_t select_support::overhead()
 {
-    return 0;
-}
\ No newline at end of file
+    return S_1.get_len() + S_0.get_len();
+}
+
+
+
+void select_support::serialize(std::ofstream &output)
+{
+    // Note that, the rank support is not being serialized; handle this issue carefully
+    // while deserializing.
+    output.write((const char *)&oneCount, sizeof(oneCount));
+    output.write((const char *)&smplWrdSz, sizeof(smplWrdSz));
+
+    S_1.serialize(output);
+    S_0.serialize(output);
+}
+
+
+
+template<typename T_input>
+void select_support::deserialize(rank_support *R, T_input &input)
+{
+    r = R;
+    B = r -> bitvector();
+
+    input.read((char *)&oneCount, sizeof(oneCount));
+    input.read((char *)&smplWrdSz, sizeof(smplWrdSz));
+
+    S_1.deserialize(input);
+    S_0.deserialize(input);
+}
+
+
+
+#endif
@@ -0,0 +1,762 @@
+#ifndef STREAM_BUILDER_H
+#define STREAM_BUILDER_H
+
+#include<cctype>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<string>
+#include<vector>
+#include<unordered_map>
+#include<fcntl.h>
+#include<unistd.h>
+
+#include "wavelet_tree.h"
+
+
+// Out-of-core construction of a wavelet tree (balanced, or Huffman-shaped), for inputs larger
+// than the memory. The input is read in chunks, twice: once to count the symbols, and once to
+// spill their codes to a temporary file. The tree is then built level by level: a level is the
+// sequence of the codes of its internal nodes, one node after the other; and a pass over it
+// writes the bitvector of every node, computes the rank and select directories of the node as
+// its bits stream by, and distributes the codes to the nodes of the next level, in another
+// temporary file. The bitvectors and directories are spilled to temporary files too; and the
+// index is assembled from those in the end, in the serialized layout of wavelet_tree. Besides
+// O(sigma) node metadata, the memory holds only the I/O buffers, sized to the given budget.
+//
+// The temporary files are created in the directory of the output file, and unlinked at once.
+
+
+// Creates an anonymous temporary file in the directory dir.
+inline int open_temp_file(const std::string &dir)
+{
+    std::string path = dir + "/wt_spill_XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+
+    int fd = mkstemp(name.data());
+    if(fd < 0)
+    {
+        std::cerr << "Unable to create a temporary file in " << dir << ".\n";
+        exit(1);
+    }
+
+    unlink(name.data());
+
+    return fd;
+}
+
+
+
+inline void write_at(int fd, const void *buf, uint64_t count, uint64_t offset)
+{
+    for(uint64_t done = 0; done < count; )
+    {
+        ssize_t n = pwrite(fd, (const char *)buf + done, count - done, offset + done);
+        if(n <= 0)
+        {
+            std::cerr << "Unable to write a temporary file; out of disk space?\n";
+            exit(1);
+        }
+
+        done += n;
+    }
+}
+
+
+
+inline void read_at(int fd, void *buf, uint64_t count, uint64_t offset)
+{
+    for(uint64_t done = 0; done < count; )
+    {
+        ssize_t n = pread(fd, (char *)buf + done, count - done, offset + done);
+        if(n <= 0)
+        {
+            std::cerr << "Unable to read a temporary file.\n";
+            exit(1);
+        }
+
+        done += n;
+    }
+}
+
+
+
+// Temporary file of bits, appended in regions starting at word boundaries; every region is
+// written out as a serialized bit_vector in the end.
+
+class bit_spill
+{
+private:
+    int fd;
+    std::vector<uint64_t> buf;  // Words not written to the file yet.
+    uint64_t bufCap;            // Capacity of the buffer, in words.
+    uint64_t fileWrds;          // Number of words written to the file.
+    uint64_t curr;              // Word being filled.
+    uint8_t currLen;            // Number of bits in the word being filled.
+
+    inline void push(uint64_t wrd) { buf.push_back(wrd); if(buf.size() == bufCap) flush(); }
+    void flush();
+
+    bit_spill(const bit_spill &);
+    bit_spill &operator=(const bit_spill &);
+
+
+public:
+    struct region
+    {
+        uint64_t first; // Index of the first word.
+        uint64_t len;   // Number of bits.
+    };
+
+    bit_spill(const std::string &dir, uint64_t bufBytes);
+    ~bit_spill() { close(fd); }
+
+    uint64_t bit_count() { return (fileWrds + buf.size()) * 64 + currLen; }
+    uint64_t begin_region();
+    region end_region(uint64_t first) { region reg = {first, bit_count() - first * 64}; return reg; }
+    inline void append_bit(bool bit);
+    inline void append(uint64_t val, uint8_t width);
+    void finish();
+    void serialize(std::ofstream &output, region reg);
+};
+
+
+
+bit_spill::bit_spill(const std::string &dir, uint64_t bufBytes):
+    fd(open_temp_file(dir)),
+    bufCap(std::max<uint64_t>(bufBytes / 8, 1)),
+    fileWrds(0),
+    curr(0),
+    currLen(0)
+{
+    buf.reserve(bufCap);
+}
+
+
+
+void bit_spill::flush()
+{
+    write_at(fd, buf.data(), buf.size() * 8, fileWrds * 8);
+    fileWrds += buf.size();
+    buf.clear();
+}
+
+
+
+uint64_t bit_spill::begin_region()
+{
+    // Pads the word being filled; and returns the index of the first word of the new region.
+
+    if(currLen)
+        push(curr), curr = 0, currLen = 0;
+
+    return fileWrds + buf.size();
+}
+
+
+
+void bit_spill::append_bit(bool bit)
+{
+    curr |= (uint64_t)bit << currLen;
+
+    if(++currLen == 64)
+        push(curr), curr = 0, currLen = 0;
+}
+
+
+
+void bit_spill::append(uint64_t val, uint8_t width)
+{
+    // Appends the width (at most 64) low bits of val, in the bit order of bit_vector::set_int.
+
+    if(!width)
+        return;
+
+    val &= (width < 64 ? (1ULL << width) - 1 : ~0ULL);
+    curr |= val << currLen;
+
+    if(currLen + width < 64)
+    {
+        currLen += width;
+        return;
+    }
+
+    push(curr);
+    curr = (currLen ? val >> (64 - currLen) : 0);
+    currLen = currLen + width - 64;
+}
+
+
+
+void bit_spill::finish()
+{
+    begin_region();
+    flush();
+}
+
+
+
+void bit_spill::serialize(std::ofstream &output, region reg)
+{
+    // Writes the region out as bit_vector::serialize would write a bitvector of it: the
+    // length, the padding to an 8-byte aligned file offset, and the whole words.
+
+    output.write((const char *)&reg.len, sizeof(reg.len));
+
+    const char pad[8] = {0};
+    output.write(pad, (8 - (uint64_t)output.tellp() % 8) % 8);
+
+    uint64_t wrdCnt = (reg.len + 63) / 64;
+
+    buf.resize(bufCap);
+
+    for(uint64_t i = 0; i < wrdCnt; i += bufCap)
+    {
+        uint64_t cnt = std::min(bufCap, wrdCnt - i);
+
+        read_at(fd, buf.data(), cnt * 8, (reg.first + i) * 8);
+        output.write((const char *)buf.data(), cnt * 8);
+    }
+
+    buf.clear();
+}
+
+
+
+// Buffered writer of symbol codes to a temporary file, from a given position on.
+
+template<typename T_code>
+class code_writer
+{
+private:
+    int fd;
+    uint64_t pos;               // Position of the first buffered code in the file.
+    std::vector<T_code> buf;
+    uint64_t bufCap;
+
+public:
+    code_writer(int fd, uint64_t bufBytes): fd(fd), pos(0), bufCap(std::max<uint64_t>(bufBytes / sizeof(T_code), 1)) { buf.reserve(bufCap); }
+    ~code_writer() { flush(); }
+
+    void seek(uint64_t p) { flush(); pos = p; }
+    inline void put(T_code code) { buf.push_back(code); if(buf.size() == bufCap) flush(); }
+    void flush() { write_at(fd, buf.data(), buf.size() * sizeof(T_code), pos * sizeof(T_code)); pos += buf.size(); buf.clear(); }
+};
+
+
+
+// Buffered sequential reader of the first count codes of a temporary file.
+
+template<typename T_code>
+class code_reader
+{
+private:
+    int fd;
+    uint64_t count;             // Number of codes to read.
+    uint64_t pos;               // Position of the buffer in the file.
+    std::vector<T_code> buf;
+    uint64_t idx;               // Index of the next code in the buffer.
+
+public:
+    code_reader(int fd, uint64_t count, uint64_t bufBytes):
+        fd(fd), count(count), pos(0), buf(std::max<uint64_t>(bufBytes / sizeof(T_code), 1)), idx(buf.size()) { pos -= buf.size(); }
+
+    inline T_code get()
+    {
+        if(idx == buf.size())
+        {
+            pos += buf.size(), idx = 0;
+            read_at(fd, buf.data(), std::min<uint64_t>(buf.size(), count - pos) * sizeof(T_code), pos * sizeof(T_code));
+        }
+
+        return buf[idx++];
+    }
+};
+
+
+
+// Chunked reader of the symbols of an input file: all its bytes, or the whitespace-separated
+// unsigned integers in it.
+
+class symbol_reader
+{
+private:
+    FILE *file;
+    std::string fileName;
+    bool integers;
+    std::string token;  // Token of the integer symbol being read.
+    std::vector<char> buf;
+    uint64_t size;  // Number of bytes in the buffer.
+    uint64_t idx;   // Index of the next byte in the buffer.
+
+    inline bool next_byte(char &ch);
+
+public:
+    symbol_reader(const std::string &fileName, bool integers, uint64_t bufBytes);
+    ~symbol_reader() { if(file) fclose(file); }
+
+    bool is_open() { return file != NULL; }
+    inline bool next(uint32_t &symbol);
+};
+
+
+
+symbol_reader::symbol_reader(const std::string &fileName, bool integers, uint64_t bufBytes):
+    file(fopen(fileName.c_str(), "rb")),
+    fileName(fileName),
+    integers(integers),
+    buf(std::max<uint64_t>(bufBytes, 1)),
+    size(0),
+    idx(0)
+{
+}
+
+
+
+bool symbol_reader::next_byte(char &ch)
+{
+    if(idx == size)
+    {
+        size = fread(buf.data(), 1, buf.size(), file), idx = 0;
+        if(!size)
+            return false;
+    }
+
+    ch = buf[idx++];
+    return true;
+}
+
+
+
+bool symbol_reader::next(uint32_t &symbol)
+{
+    char ch;
+
+    if(!integers)
+    {
+        if(!next_byte(ch))
+            return false;
+
+        symbol = (uint8_t)ch;
+        return true;
+    }
+
+
+    // A symbol is a maximal run of non-whitespace bytes, validated like by read_text.
+
+    do
+        if(!next_byte(ch))
+            return false;
+    while(isspace((uint8_t)ch));
+
+    token.clear();
+
+    do
+        token += ch;
+    while(next_byte(ch) && !isspace((uint8_t)ch));
+
+    symbol = parse_symbol_token(token, fileName);
+    return true;
+}
+
+
+
+class stream_builder
+{
+private:
+    struct node_rec
+    {
+        uint32_t left;      // Left limit of the alphabet.
+        uint32_t right;     // Right limit of the alphabet.
+        uint32_t mid;       // Last character of the left subtree.
+        uint64_t len;       // Number of text characters in the node.
+        uint64_t child[2];  // Records of the left and right subtrees.
+        uint64_t oneCount;  // Number of ones in the bitvector.
+        bit_spill::region B, R_s, R_b, S_1, S_0;
+    };
+
+    struct level_node
+    {
+        uint64_t rec;       // Record of the node.
+        uint8_t depth;
+    };
+
+    std::string tmpDir;
+    uint64_t bufBytes;      // Size of each I/O buffer.
+    alphabet_map alphabet;
+    std::vector<uint64_t> freq;     // Frequency of each code.
+    std::vector<uint64_t> code;     // Huffman code of each code; empty for the balanced shape.
+    std::vector<node_rec> nodes;
+
+    bit_spill *B, *R_s, *R_b, *S_1, *S_0;
+
+
+    void count_symbols(const std::string &inputFile, bool integers);
+    template<typename T_code> void build_levels(const std::string &inputFile, bool integers);
+    void build_node(level_node &v, uint64_t *prefix, std::vector<level_node> &next, uint64_t &nextLen);
+    template<typename T_code> void write_node(uint64_t rec, code_reader<T_code> &input, code_writer<T_code> **output);
+    void serialize_node(std::ofstream &output, uint64_t rec);
+
+
+public:
+    stream_builder(std::string &inputFile, std::string &outputFile, uint64_t memoryBudget, bool huffman = false, bool integers = false);
+};
+
+
+
+stream_builder::stream_builder(std::string &inputFile, std::string &outputFile, uint64_t memoryBudget, bool huffman, bool integers)
+{
+    // At most ten I/O buffers are in use at a time: the input, or the level being read, the
+    // two write positions in the next level, and the five bitvector spills (or the output).
+
+    bufBytes = std::max<uint64_t>(memoryBudget / 10, 1 << 16);
+
+    std::string::size_type slash = outputFile.rfind('/');
+    tmpDir = (slash == std::string::npos ? "." : outputFile.substr(0, std::max<std::string::size_type>(slash, 1)));
+
+
+    // Map the alphabet in the symbol order, or in the order of the Huffman codes.
+
+    count_symbols(inputFile, integers);
+
+    uint64_t codeBits = 0;
+    if(huffman)
+        codeBits = wavelet_tree::huffman_codes(freq, alphabet, code);
+
+    uint64_t len = 0;
+    for(auto p = freq.begin(); p != freq.end(); ++p)
+        len += *p;
+
+
+    node_rec root = {0, (uint32_t)std::max<uint64_t>(alphabet.size(), 1) - 1, 0, len, {0, 0}, 0, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}};
+    nodes.push_back(root);
+
+    bit_spill b(tmpDir, bufBytes), rs(tmpDir, bufBytes), rb(tmpDir, bufBytes), s1(tmpDir, bufBytes), s0(tmpDir, bufBytes);
+    B = &b, R_s = &rs, R_b = &rb, S_1 = &s1, S_0 = &s0;
+
+
+    // Build the levels, over the codes in the narrowest type holding them.
+
+    uint8_t wrdSz = 0;
+    while((1ULL << wrdSz) < alphabet.size())
+        wrdSz++;
+
+    if(wrdSz <= 8)
+        build_levels<uint8_t>(inputFile, integers);
+    else if(wrdSz <= 16)
+        build_levels<uint16_t>(inputFile, integers);
+    else
+        build_levels<uint32_t>(inputFile, integers);
+
+
+    // Assemble the index: the format identifier, the alphabet mapping, and the nodes in
+    // the order of wavelet_tree::serialize_wavelet_tree.
+
+    b.finish(), rs.finish(), rb.finish(), s1.finish(), s0.finish();
+
+    std::ofstream output;
+    output.open(outputFile.c_str(), std::ios::binary | std::ios::out);
+
+    uint64_t magic = wavelet_tree::MAGIC;
+    output.write((const char *)&magic, sizeof(magic));
+
+    alphabet.serialize(output);
+
+    uint8_t kind = 0;   // Plain node bitvectors.
+    output.write((const char *)&kind, sizeof(kind));
+
+    serialize_node(output, 0);
+
+    output.close();
+
+
+    std::cout << "Size of the alphabet the tree is constructed over: " << alphabet.size() << "\n";
+    std::cout << "Number of characters in the input string: " << len << "\n";
+
+    if(huffman && len)
+        std::cout << "Average Huffman code length: " << double(codeBits) / len << " bits\n";
+}
+
+
+
+void stream_builder::count_symbols(const std::string &inputFile, bool integers)
+{
+    symbol_reader input(inputFile, integers, bufBytes);
+    uint32_t symbol;
+
+    if(!input.is_open())
+    {
+        std::cerr << "Unable to open " << inputFile << ".\n";
+        exit(1);
+    }
+
+
+    if(!integers)
+    {
+        std::vector<uint64_t> count(256, 0);
+
+        while(input.next(symbol))
+            count[symbol]++;
+
+        std::string distinct;
+        for(uint32_t c = 0; c < 256; ++c)
+            if(count[c])
+                distinct.push_back(c);
+
+        alphabet.build(distinct);
+
+        freq.assign(alphabet.size(), 0);
+        for(uint32_t c = 0; c < 256; ++c)
+            if(count[c])
+                freq[alphabet.code(c)] = count[c];
+
+        return;
+    }
+
+
+    std::unordered_map<uint32_t, uint64_t> count;
+
+    while(input.next(symbol))
+        count[symbol]++;
+
+    std::vector<uint32_t> distinct;
+    for(auto p = count.begin(); p != count.end(); ++p)
+        distinct.push_back(p -> first);
+
+    alphabet.build(distinct);
+
+    freq.assign(alphabet.size(), 0);
+    for(auto p = count.begin(); p != count.end(); ++p)
+        freq[alphabet.code(p -> first)] = p -> second;
+}
+
+
+
+template<typename T_code>
+void stream_builder::build_levels(const std::string &inputFile, bool integers)
+{
+    if(nodes[0].left == nodes[0].right)
+        return; // A single leaf.
+
+
+    // Spill the codes of the text, as the root level.
+
+    int currFd = open_temp_file(tmpDir);
+
+    {
+        symbol_reader input(inputFile, integers, bufBytes);
+        code_writer<T_code> output(currFd, bufBytes);
+        uint32_t symbol;
+
+        while(input.next(symbol))
+            output.put(alphabet.code(symbol));
+    }
+
+
+    std::vector<uint64_t> prefix(alphabet.size() + 1, 0);   // Count of the codes less than each.
+    for(uint64_t c = 0; c < alphabet.size(); ++c)
+        prefix[c + 1] = prefix[c] + freq[c];
+
+    std::vector<level_node> curr(1), next;
+    uint64_t currLen = nodes[0].len;
+
+    curr[0].rec = 0, curr[0].depth = 0;
+
+
+    while(!curr.empty())
+    {
+        // Lay out the internal children of the level's nodes in the next level; then pass
+        // over the level, writing the nodes and distributing their codes.
+
+        int nextFd = open_temp_file(tmpDir);
+        uint64_t nextLen = 0;
+
+        next.clear();
+        for(auto v = curr.begin(); v != curr.end(); ++v)
+            build_node(*v, prefix.data(), next, nextLen);
+
+        {
+            code_reader<T_code> input(currFd, currLen, bufBytes);
+            code_writer<T_code> outL(nextFd, bufBytes), outR(nextFd, bufBytes);
+            code_writer<T_code> *output[2] = {&outL, &outR};
+
+            for(auto v = curr.begin(); v != curr.end(); ++v)
+            {
+                node_rec &rec = nodes[v -> rec];
+
+                for(uint8_t i = 0; i < 2; ++i)
+                {
+                    node_rec &child = nodes[rec.child[i]];
+                    output[i] -> seek(child.left < child.right ? child.oneCount : 0);
+                }
+
+                write_node(v -> rec, input, output);
+            }
+        }
+
+        close(currFd);
+        currFd = nextFd, currLen = nextLen;
+        curr.swap(next);
+    }
+
+    close(currFd);
+}
+
+
+
+void stream_builder::build_node(level_node &v, uint64_t *prefix, std::vector<level_node> &next, uint64_t &nextLen)
+{
+    // Splits the alphabet of the node, and creates the records of its subtrees. The internal
+    // subtrees are appended to the next level; the offset of each in the next level is kept
+    // in its oneCount, until it is written.
+
+    uint32_t l = nodes[v.rec].left, r = nodes[v.rec].right;
+    uint32_t mid = (code.empty() ? l + (r - l) / 2 : wavelet_tree::huffman_split(l, r, v.depth, code));
+
+    nodes[v.rec].mid = mid;
+
+    uint32_t limit[2][2] = {{l, mid}, {mid + 1, r}};
+
+    for(uint8_t i = 0; i < 2; ++i)
+    {
+        node_rec child = {limit[i][0], limit[i][1], 0, prefix[limit[i][1] + 1] - prefix[limit[i][0]], {0, 0}, 0,
+                            {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}};
+
+        if(child.left < child.right)
+        {
+            level_node w = {nodes.size(), (uint8_t)(v.depth + 1)};
+            next.push_back(w);
+
+            child.oneCount = nextLen;
+            nextLen += child.len;
+        }
+
+        nodes[v.rec].child[i] = nodes.size();
+        nodes.push_back(child);
+    }
+}
+
+
+
+template<typename T_code>
+void stream_builder::write_node(uint64_t recIdx, code_reader<T_code> &input, code_writer<T_code> **output)
+{
+    // Streams the node's codes: appends the bit of each to the bitvector, and the code to the
+    // subtree's part of the next level (if not a leaf); meanwhile recording the superblock and
+    // block values of rank_support, and the sampled positions of select_support.
+
+    node_rec &rec = nodes[recIdx];
+    uint32_t mid = rec.mid;
+    bool internal[2] = {nodes[rec.child[0]].left < nodes[rec.child[0]].right,
+                        nodes[rec.child[1]].left < nodes[rec.child[1]].right};
+
+    rank_support layout;
+    layout.set_layout(rec.len);
+
+    uint64_t supBlkLen = layout.supBlkLen, blkLen = layout.blkLen, blkCnt = layout.blkCntPerSupBlk;
+    uint8_t supBlkWrdSz = layout.supBlkWrdSz, blkWrdSz = layout.blkWrdSz;
+    uint8_t smplWrdSz = select_support::sample_width(rec.len);
+    const uint64_t SAMPLE_RATE = select_support::SAMPLE_RATE;
+
+    uint64_t first[5] = {B -> begin_region(), R_s -> begin_region(), R_b -> begin_region(),
+                        S_1 -> begin_region(), S_0 -> begin_region()};
+
+    uint64_t ones = 0;          // Ones before the current position.
+    uint64_t supBlkOnes = 0;    // Ones before the current position in its superblock.
+    uint64_t supBlkPos = 0;     // Offset of the current position in its superblock.
+    uint64_t blkDone = 0;       // Blocks of the superblock recorded.
+
+    for(uint64_t pos = 0; pos < rec.len; ++pos)
+    {
+        if(pos && supBlkPos == supBlkLen)
+        {
+            // The blocks past the superblock's end hold its whole count.
+            for(; blkDone < blkCnt; ++blkDone)
+                R_b -> append(supBlkOnes, blkWrdSz);
+
+            supBlkPos = 0, supBlkOnes = 0, blkDone = 0;
+        }
+
+        if(!supBlkPos)
+            R_s -> append(ones, supBlkWrdSz);
+
+        if(supBlkPos == blkDone * blkLen && blkDone < blkCnt)
+            R_b -> append(supBlkOnes, blkWrdSz), blkDone++;
+
+
+        T_code c = input.get();
+        bool bit = (c > mid);
+
+        B -> append_bit(bit);
+
+        if(bit)
+        {
+            if(ones % SAMPLE_RATE == 0)
+                S_1 -> append(pos, smplWrdSz);
+
+            ones++, supBlkOnes++;
+        }
+        else if((pos - ones) % SAMPLE_RATE == 0)
+            S_0 -> append(pos, smplWrdSz);
+
+        if(internal[bit])
+            output[bit] -> put(c);
+
+        supBlkPos++;
+    }
+
+    for(; rec.len && blkDone < blkCnt; ++blkDone)
+        R_b -> append(supBlkOnes, blkWrdSz);
+
+
+    rec.oneCount = ones;
+    rec.B = B -> end_region(first[0]);
+    rec.R_s = R_s -> end_region(first[1]);
+    rec.R_b = R_b -> end_region(first[2]);
+    rec.S_1 = S_1 -> end_region(first[3]);
+    rec.S_0 = S_0 -> end_region(first[4]);
+}
+
+
+
+void stream_builder::serialize_node(std::ofstream &output, uint64_t recIdx)
+{
+    // Mirrors wavelet_tree::serialize_wavelet_tree, rank_support::serialize and
+    // select_support::serialize.
+
+    node_rec &rec = nodes[recIdx];
+
+    output.write((const char *)&rec.left, sizeof(rec.left));
+    output.write((const char *)&rec.right, sizeof(rec.right));
+    output.write((const char *)&rec.len, sizeof(rec.len));
+
+    if(rec.left == rec.right)
+        return;
+
+    output.write((const char *)&rec.mid, sizeof(rec.mid));
+
+    B -> serialize(output, rec.B);
+
+    rank_support layout;
+    layout.set_layout(rec.len);
+    layout.serialize_layout(output);
+
+    R_s -> serialize(output, rec.R_s);
+    R_b -> serialize(output, rec.R_b);
+
+    uint8_t smplWrdSz = select_support::sample_width(rec.len);
+
+    output.write((const char *)&rec.oneCount, sizeof(rec.oneCount));
+    output.write((const char *)&smplWrdSz, sizeof(smplWrdSz));
+
+    S_1 -> serialize(output, rec.S_1);
+    S_0 -> serialize(output, rec.S_0);
+
+    serialize_node(output, rec.child[0]);
+    serialize_node(output, rec.child[1]);
+}
+
+
+
+#endif
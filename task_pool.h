@@ -0,0 +1,203 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include<cstdint>
+#include<vector>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<atomic>
+#include<functional>
+
+
+// Work-stealing pool of worker threads. Every worker owns a task queue: the tasks submitted
+// from a worker go to the back of its own queue, and it runs tasks from the back (i.e. the
+// most recent, smaller subproblems first); an idle worker steals from the front of the other
+// queues (i.e. the oldest, larger subproblems). Tasks submitted from outside the pool go to
+// an extra shared queue.
+
+class task_pool
+{
+private:
+    struct task_queue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    struct worker_tag
+    {
+        task_pool *pool;    // Pool the current thread works for; NULL for the outside threads.
+        unsigned idx;       // Index of the current thread's queue in the pool.
+    };
+
+    unsigned threadCount;
+    std::vector<std::thread> workers;
+    std::vector<task_queue> queues;     // One queue per worker, followed by the shared queue.
+    std::atomic<uint64_t> queued;       // Number of tasks submitted, but not taken yet.
+    std::atomic<uint64_t> pending;      // Number of tasks submitted, but not finished yet.
+    std::mutex stateLock;
+    std::condition_variable workAvail;  // Notified on new tasks, and on stopping.
+    std::condition_variable allDone;    // Notified when no tasks are pending.
+    bool stop;
+
+
+    static worker_tag &current() { static thread_local worker_tag tag = {NULL, 0}; return tag; }
+    unsigned queue_idx() { return current().pool == this ? current().idx : threadCount; }
+    bool try_run(unsigned idx);
+    void work(unsigned idx);
+
+    task_pool(const task_pool &);
+    task_pool &operator=(const task_pool &);
+
+
+public:
+    task_pool(unsigned threadCount);
+    ~task_pool();
+
+    unsigned thread_count() { return threadCount; }
+    void submit(std::function<void()> task);
+    void parallel_for(uint64_t count, const std::function<void(uint64_t)> &fn);
+    void wait();
+};
+
+
+
+task_pool::task_pool(unsigned threadCount):
+    threadCount(threadCount),
+    queues(threadCount + 1),
+    queued(0),
+    pending(0),
+    stop(false)
+{
+    for(unsigned i = 0; i < threadCount; ++i)
+        workers.push_back(std::thread(&task_pool::work, this, i));
+}
+
+
+
+task_pool::~task_pool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stop = true;
+    }
+
+    workAvail.notify_all();
+
+    for(auto p = workers.begin(); p != workers.end(); ++p)
+        p -> join();
+}
+
+
+
+void task_pool::submit(std::function<void()> task)
+{
+    task_queue &q = queues[queue_idx()];
+
+    pending++, queued++;
+
+    {
+        std::lock_guard<std::mutex> guard(q.lock);
+        q.tasks.push_back(std::move(task));
+    }
+
+    // Acquire the state lock before notifying, so that a worker checking for work
+    // can not miss the notification.
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+    }
+
+    workAvail.notify_one();
+}
+
+
+
+bool task_pool::try_run(unsigned idx)
+{
+    // Take the most recent task from the own queue, or steal the oldest one from the others.
+
+    std::function<void()> task;
+
+    for(unsigned i = 0; i <= threadCount && !task; ++i)
+    {
+        task_queue &q = queues[(idx + i) % (threadCount + 1)];
+        std::lock_guard<std::mutex> guard(q.lock);
+
+        if(q.tasks.empty())
+            continue;
+
+        if(!i)
+            task = std::move(q.tasks.back()), q.tasks.pop_back();
+        else
+            task = std::move(q.tasks.front()), q.tasks.pop_front();
+    }
+
+    if(!task)
+        return false;
+
+
+    queued--;
+    task();
+
+    if(--pending == 0)
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        allDone.notify_all();
+    }
+
+    return true;
+}
+
+
+
+void task_pool::work(unsigned idx)
+{
+    current().pool = this, current().idx = idx;
+
+    while(true)
+    {
+        if(try_run(idx))
+            continue;
+
+        std::unique_lock<std::mutex> lock(stateLock);
+        workAvail.wait(lock, [this]() { return queued > 0 || stop; });
+
+        if(stop && !queued)
+            return;
+    }
+}
+
+
+
+void task_pool::parallel_for(uint64_t count, const std::function<void(uint64_t)> &fn)
+{
+    // Runs fn(0), ..., fn(count - 1) as tasks, and returns once all of them are finished.
+    // The calling thread runs tasks too in the meantime; so that the workers waiting here
+    // from inside the tasks of the pool can not deadlock it.
+
+    std::atomic<uint64_t> left(count);
+
+    for(uint64_t i = 0; i < count; ++i)
+        submit([&fn, &left, i]() { fn(i); left--; });
+
+    unsigned idx = queue_idx();
+    while(left)
+        if(!try_run(idx))
+            std::this_thread::yield();
+}
+
+
+
+void task_pool::wait()
+{
+    std::unique_lock<std::mutex> lock(stateLock);
+    allDone.wait(lock, [this]() { return !pending; });
+}
+
+
+
+#endif
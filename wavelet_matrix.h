@@ -0,0 +1,616 @@
+#ifndef WAVELET_MATRIX_H
+#define WAVELET_MATRIX_H
+
+#include<iostream>
+#include<fstream>
+#include<string>
+#include<vector>
+#include<cmath>
+#include<limits>
+#include<utility>
+#include<algorithm>
+
+#include "select_support.h"
+#include "alphabet_map.h"
+#include "batch_executor.h"
+#include "query_drivers.h"
+
+
+// Pointerless alternative to the wavelet tree (Claude, Navarro and Ordonez, 2015).
+// Level l holds one bitvector over the whole text, containing the l'th most significant
+// bit of each symbol code, where the symbols are stably sorted by their l (reversed) most
+// significant bits; all the zeroes of a level move to the front of the next level, so
+// every node interval is found through Z[l] (the count of zeroes at level l) and rank.
+
+class wavelet_matrix
+{
+private:
+    const static uint64_t MAGIC = 0x33584952544d5457ULL; // "WTMTRIX3", identifies a serialized matrix.
+    const static uint8_t MAX_LEVEL = 32;                  // Bit-length of the largest symbol code.
+
+    uint64_t len;                   // Length of the text.
+    uint8_t levelCnt;               // Number of levels, i.e. bit-length of each symbol code.
+    uint64_t Z[MAX_LEVEL];          // Count of zeroes at each level.
+    bit_vector B[MAX_LEVEL];        // Bitvector at each level.
+    rank_support r[MAX_LEVEL];      // Rank support for each level bitvector.
+    select_support s[MAX_LEVEL];    // Select support on each rank support.
+
+
+    template<typename T_text> void build_index(T_text &text, std::string &outputFile, unsigned threadCount);
+    template<typename T_text> void build(T_text &text, alphabet_map &alphabet, unsigned threadCount);
+    template<typename T_code, typename T_text> void build_levels(T_text &text, alphabet_map &alphabet, task_pool *pool);
+    void serialize(std::ofstream &output, alphabet_map &alphabet);
+    template<typename T_input> bool deserialize_index(T_input &input, alphabet_map &alphabet);
+
+    inline uint64_t rank0_ex(uint8_t level, uint64_t idx) { count_node_op(level); return idx ? r[level].rank0(idx - 1) : 0; }
+    inline uint64_t rank1_ex(uint8_t level, uint64_t idx) { count_node_op(level); return idx ? r[level].rank1(idx - 1) : 0; }
+    inline uint8_t code_bit(uint32_t ch, uint8_t level) { return (ch >> (levelCnt - 1 - level)) & 1; }
+    inline void prefetch(uint8_t level, uint64_t idx) { if(level < levelCnt && idx) r[level].prefetch(idx - 1); }
+
+    struct access_query;
+    struct rank_query;
+    struct select_query;
+
+
+public:
+    wavelet_matrix() { len = 0, levelCnt = 0; }
+    wavelet_matrix(std::string &inputFile, std::string &outputFile, unsigned threadCount = 1, bool integers = false);
+    wavelet_matrix(std::string &text, unsigned threadCount = 1);
+    wavelet_matrix(std::vector<uint32_t> &text, unsigned threadCount = 1);
+
+    uint64_t get_len() { return len; }
+    uint32_t access(uint64_t idx);
+    uint64_t rank(uint32_t ch, uint64_t idx);
+    uint64_t select(uint32_t ch, uint64_t rank);
+
+    void access(std::vector<uint64_t> &indices, std::vector<uint32_t> &result);
+    void rank(std::vector<std::pair<uint32_t, uint64_t>> &queries, std::vector<uint64_t> &result);
+    void select(std::vector<std::pair<uint32_t, uint64_t>> &queries, std::vector<uint64_t> &result);
+    uint64_t size_in_bits();
+
+    void deserialize(std::string &matrixFile, alphabet_map &alphabet, mmap_reader *mapping = NULL);
+    static bool is_wavelet_matrix(std::string &fileName);
+
+    static void access_queries(std::string &wmFileName, std::string &accessIndices, bool mmapped = false, unsigned threadCount = 1,
+                                bool binary = false, bool profile = false);
+    static void rank_queries(std::string &wmFileName, std::string &queryIndices, bool mmapped = false, unsigned threadCount = 1,
+                                bool binary = false, bool profile = false);
+    static void select_queries(std::string &wmFileName, std::string &queryIndices, bool mmapped = false, unsigned threadCount = 1,
+                                bool binary = false, bool profile = false);
+};
+
+
+
+// States of the queries in a batch; see run_interleaved. Each step maps a query from one
+// level to the next (or, for select, the previous one).
+
+struct wavelet_matrix::access_query
+{
+    wavelet_matrix *wm;
+    uint8_t level;
+    uint64_t idx;       // Index of the queried character at the level.
+    uint32_t ch;        // Code bits of the character read so far; the answer in the end.
+
+    void start() { wm -> prefetch(level, idx + 1); }
+    bool step();
+};
+
+
+
+struct wavelet_matrix::rank_query
+{
+    wavelet_matrix *wm;
+    uint8_t level;
+    uint32_t ch;
+    uint64_t lo;        // Interval [lo, hi) of the queried prefix restricted to the node of ch
+    uint64_t hi;        // at the level; its length is the answer in the end.
+
+    void start() { wm -> prefetch(level, lo), wm -> prefetch(level, hi); }
+    bool step();
+};
+
+
+
+struct wavelet_matrix::select_query
+{
+    wavelet_matrix *wm;
+    uint8_t level;
+    bool up;            // Whether mapping the occurrence back up, or still finding the node of ch.
+    uint32_t ch;
+    uint64_t rank;
+    uint64_t lo;        // Interval [lo, hi) of the node of ch at the level while going down; then lo
+    uint64_t hi;        // is the index of the occurrence at the level, and the answer in the end.
+
+    void start() { wm -> prefetch(level, lo), wm -> prefetch(level, hi); }
+    bool step();
+};
+
+
+
+wavelet_matrix::wavelet_matrix(std::string &inputFile, std::string &outputFile, unsigned threadCount, bool integers)
+{
+    // Read in the text: a line of characters, or a sequence of integer symbols.
+
+    if(integers)
+    {
+        std::vector<uint32_t> text;
+        read_text(inputFile, text);
+
+        build_index(text, outputFile, threadCount);
+    }
+    else
+    {
+        std::string text;
+        read_text(inputFile, text);
+
+        build_index(text, outputFile, threadCount);
+    }
+}
+
+
+
+wavelet_matrix::wavelet_matrix(std::string &text, unsigned threadCount)
+{
+    alphabet_map alphabet;
+    alphabet.build(text);
+
+    build(text, alphabet, threadCount);
+}
+
+
+
+wavelet_matrix::wavelet_matrix(std::vector<uint32_t> &text, unsigned threadCount)
+{
+    alphabet_map alphabet;
+    alphabet.build(text);
+
+    build(text, alphabet, threadCount);
+}
+
+
+
+template<typename T_text>
+void wavelet_matrix::build_index(T_text &text, std::string &outputFile, unsigned threadCount)
+{
+    // Map the arbitrary alphabet to a [0, sigma) range, in the symbol order.
+
+    alphabet_map alphabet;
+    alphabet.build(text);
+
+
+    // Build the wavelet matrix.
+    build(text, alphabet, threadCount);
+
+
+    // Seralize the alphabet mapping, and the wavelet matrix.
+
+    std::ofstream output;
+    output.open(outputFile.c_str(), std::ios::binary | std::ios::out);
+
+    serialize(output, alphabet);
+
+    output.close();
+
+
+    std::cout << "Size of the alphabet the matrix is constructed over: " << alphabet.size() << "\n";
+    std::cout << "Number of characters in the input string: " << text.size() << "\n";
+}
+
+
+
+template<typename T_text>
+void wavelet_matrix::build(T_text &text, alphabet_map &alphabet, unsigned threadCount)
+{
+    // Every level depends on the previous one; so only the rank directories are built in
+    // parallel, with more than one thread.
+
+    task_pool *pool = (threadCount > 1 ? new task_pool(threadCount) : NULL);
+
+    len = text.size();
+
+    for(levelCnt = 0; (1ULL << levelCnt) < alphabet.size(); )
+        levelCnt++;
+
+    // The codes are partitioned level by level in arrays of the narrowest type holding them.
+
+    if(levelCnt <= 8)
+        build_levels<uint8_t>(text, alphabet, pool);
+    else if(levelCnt <= 16)
+        build_levels<uint16_t>(text, alphabet, pool);
+    else
+        build_levels<uint32_t>(text, alphabet, pool);
+
+    delete pool;
+}
+
+
+
+template<typename T_code, typename T_text>
+void wavelet_matrix::build_levels(T_text &text, alphabet_map &alphabet, task_pool *pool)
+{
+    std::vector<T_code> curr(len), next(len);
+    for(uint64_t i = 0; i < len; ++i)
+        curr[i] = alphabet.code(symbol_at(text, i));
+
+
+    for(uint8_t l = 0; l < levelCnt; ++l)
+    {
+        B[l].set_len(len);
+
+        // Stable partition of the current level: zeroes first, then ones.
+
+        uint64_t zeroCount = 0;
+        for(uint64_t i = 0; i < len; ++i)
+            if(!code_bit(curr[i], l))
+                zeroCount++;
+
+        uint64_t countL = 0, countR = zeroCount;
+        for(uint64_t i = 0; i < len; ++i)
+            if(code_bit(curr[i], l))
+            {
+                B[l].set_bit(i);
+                next[countR++] = curr[i];
+            }
+            else
+                next[countL++] = curr[i];
+
+
+        Z[l] = zeroCount;
+        r[l].build(&B[l], pool);
+        s[l].build(&r[l]);
+
+        curr.swap(next);
+    }
+}
+
+
+
+uint32_t wavelet_matrix::access(uint64_t idx)
+{
+    uint32_t ch = 0;
+
+    for(uint8_t l = 0; l < levelCnt; ++l)
+    {
+        bool bit = B[l].get_bit(idx);
+
+        ch = (ch << 1) | bit;
+        count_node_op(l);
+        idx = (bit ? Z[l] + r[l].rank1(idx) : r[l].rank0(idx)) - 1;
+    }
+
+    return ch;
+}
+
+
+
+uint64_t wavelet_matrix::rank(uint32_t ch, uint64_t idx)
+{
+    // Track the interval [start, end) of the prefix text[0..idx] restricted to the
+    // node of ch at each level.
+
+    uint64_t start = 0, end = (idx >= len ? len : idx + 1);  // Not min(idx + 1, len), which wraps at the max idx.
+
+    for(uint8_t l = 0; l < levelCnt && start < end; ++l)
+        if(code_bit(ch, l))
+            start = Z[l] + rank1_ex(l, start), end = Z[l] + rank1_ex(l, end);
+        else
+            start = rank0_ex(l, start), end = rank0_ex(l, end);
+
+    return end - start;
+}
+
+
+
+uint64_t wavelet_matrix::select(uint32_t ch, uint64_t rank)
+{
+    // Find the interval [start, end) of ch at the last level, and then map the
+    // rank'th position of it back up through the levels.
+
+    uint64_t start = 0, end = len;
+
+    for(uint8_t l = 0; l < levelCnt; ++l)
+        if(code_bit(ch, l))
+            start = Z[l] + rank1_ex(l, start), end = Z[l] + rank1_ex(l, end);
+        else
+            start = rank0_ex(l, start), end = rank0_ex(l, end);
+
+    if(!rank || rank > end - start)
+        return std::numeric_limits<uint64_t>::max();
+
+
+    uint64_t idx = start + rank - 1;
+
+    for(uint8_t l = levelCnt; l-- > 0; )
+    {
+        count_node_op(l);
+        idx = (code_bit(ch, l) ? s[l].select1(idx - Z[l] + 1) : s[l].select0(idx + 1));
+    }
+
+    return idx;
+}
+
+
+
+bool wavelet_matrix::access_query::step()
+{
+    if(level == wm -> levelCnt)
+        return false;
+
+    bool bit = wm -> B[level].get_bit(idx);
+
+    ch = (ch << 1) | bit;
+    count_node_op(level);
+    idx = (bit ? wm -> Z[level] + wm -> r[level].rank1(idx) : wm -> r[level].rank0(idx)) - 1;
+
+    wm -> prefetch(++level, idx + 1);
+
+    return level < wm -> levelCnt;
+}
+
+
+
+bool wavelet_matrix::rank_query::step()
+{
+    if(level == wm -> levelCnt || lo >= hi)
+        return false;
+
+    if(wm -> code_bit(ch, level))
+        lo = wm -> Z[level] + wm -> rank1_ex(level, lo), hi = wm -> Z[level] + wm -> rank1_ex(level, hi);
+    else
+        lo = wm -> rank0_ex(level, lo), hi = wm -> rank0_ex(level, hi);
+
+    level++;
+    wm -> prefetch(level, lo), wm -> prefetch(level, hi);
+
+    return level < wm -> levelCnt && lo < hi;
+}
+
+
+
+bool wavelet_matrix::select_query::step()
+{
+    if(!up)
+    {
+        if(level < wm -> levelCnt)
+        {
+            if(wm -> code_bit(ch, level))
+                lo = wm -> Z[level] + wm -> rank1_ex(level, lo), hi = wm -> Z[level] + wm -> rank1_ex(level, hi);
+            else
+                lo = wm -> rank0_ex(level, lo), hi = wm -> rank0_ex(level, hi);
+
+            level++;
+            wm -> prefetch(level, lo), wm -> prefetch(level, hi);
+
+            return true;
+        }
+
+
+        // At the last level; locate the occurrence in the node of ch, and turn back up.
+
+        if(!rank || rank > hi - lo)
+        {
+            lo = std::numeric_limits<uint64_t>::max();
+            return false;
+        }
+
+        lo += rank - 1, up = true;
+    }
+    else
+    {
+        if(!level)
+            return false;
+
+        level--;
+        count_node_op(level);
+        lo = (wm -> code_bit(ch, level) ? wm -> s[level].select1(lo - wm -> Z[level] + 1) : wm -> s[level].select0(lo + 1));
+    }
+
+
+    if(!level)
+        return false;
+
+    bool bit = wm -> code_bit(ch, level - 1);
+    wm -> s[level - 1].prefetch(bit ? lo - wm -> Z[level - 1] + 1 : lo + 1, bit);
+
+    return true;
+}
+
+
+
+void wavelet_matrix::access(std::vector<uint64_t> &indices, std::vector<uint32_t> &result)
+{
+    std::vector<access_query> queries(indices.size());
+
+    for(uint64_t i = 0; i < indices.size(); ++i)
+    {
+        access_query q = {this, 0, indices[i], 0};
+        queries[i] = q;
+    }
+
+    run_interleaved(queries);
+
+
+    result.resize(indices.size());
+    for(uint64_t i = 0; i < indices.size(); ++i)
+        result[i] = queries[i].ch;
+}
+
+
+
+void wavelet_matrix::rank(std::vector<std::pair<uint32_t, uint64_t>> &queries, std::vector<uint64_t> &result)
+{
+    std::vector<rank_query> q(queries.size());
+
+    for(uint64_t i = 0; i < queries.size(); ++i)
+    {
+        rank_query query = {this, 0, queries[i].first, 0, (queries[i].second >= len ? len : queries[i].second + 1)};
+        q[i] = query;
+    }
+
+    run_interleaved(q);
+
+
+    result.resize(queries.size());
+    for(uint64_t i = 0; i < queries.size(); ++i)
+        result[i] = q[i].hi - q[i].lo;
+}
+
+
+
+void wavelet_matrix::select(std::vector<std::pair<uint32_t, uint64_t>> &queries, std::vector<uint64_t> &result)
+{
+    std::vector<select_query> q(queries.size());
+
+    for(uint64_t i = 0; i < queries.size(); ++i)
+    {
+        select_query query = {this, 0, false, queries[i].first, queries[i].second, 0, len};
+        q[i] = query;
+    }
+
+    run_interleaved(q);
+
+
+    result.resize(queries.size());
+    for(uint64_t i = 0; i < queries.size(); ++i)
+        result[i] = q[i].lo;
+}
+
+
+
+uint64_t wavelet_matrix::size_in_bits()
+{
+    // Bits of the level bitvectors, and their rank and select supports.
+
+    uint64_t bits = 0;
+
+    for(uint8_t l = 0; l < levelCnt; ++l)
+        bits += B[l].get_len() + r[l].overhead() + s[l].overhead();
+
+    return bits;
+}
+
+
+
+void wavelet_matrix::serialize(std::ofstream &output, alphabet_map &alphabet)
+{
+    uint64_t magic = MAGIC;
+    output.write((const char *)&magic, sizeof(magic));
+
+
+    // Serialize the alphabet mapping.
+
+    alphabet.serialize(output);
+
+
+    // Serialize the levels: the zero count, the bitvector, and its rank and select supports.
+
+    output.write((const char *)&len, sizeof(len));
+    output.write((const char *)&levelCnt, sizeof(levelCnt));
+
+    for(uint8_t l = 0; l < levelCnt; ++l)
+    {
+        output.write((const char *)&Z[l], sizeof(Z[l]));
+        B[l].serialize(output);
+        r[l].serialize(output);
+        s[l].serialize(output);
+    }
+}
+
+
+
+void wavelet_matrix::deserialize(std::string &matrixFile, alphabet_map &alphabet, mmap_reader *mapping)
+{
+    // With a mapping provided, the level bitvectors are viewed in the mapped file instead
+    // of being read in; the mapping must then outlive the matrix.
+
+    bool ok;
+
+    if(mapping)
+        ok = mapping -> open(matrixFile) && deserialize_index(*mapping, alphabet);
+    else
+    {
+        std::ifstream input;
+        input.open(matrixFile.c_str(), std::ios::binary | std::ios::in);
+
+        ok = deserialize_index(input, alphabet);
+    }
+
+    if(!ok)
+    {
+        std::cerr << "Unrecognized wavelet matrix file " << matrixFile << "; rebuild it with this version.\n";
+        exit(1);
+    }
+}
+
+
+
+template<typename T_input>
+bool wavelet_matrix::deserialize_index(T_input &input, alphabet_map &alphabet)
+{
+    uint64_t magic = 0;
+    input.read((char *)&magic, sizeof(magic));
+
+    if(!input || magic != MAGIC)
+        return false;
+
+
+    if(!alphabet.deserialize(input))
+        return false;
+
+
+    input.read((char *)&len, sizeof(len));
+    input.read((char *)&levelCnt, sizeof(levelCnt));
+
+    if(levelCnt > MAX_LEVEL)
+        return false;
+
+    for(uint8_t l = 0; l < levelCnt; ++l)
+    {
+        input.read((char *)&Z[l], sizeof(Z[l]));
+        B[l].deserialize(input);
+        r[l].deserialize(&B[l], input);
+        s[l].deserialize(&r[l], input);
+    }
+
+    return (bool)input;
+}
+
+
+
+bool wavelet_matrix::is_wavelet_matrix(std::string &fileName)
+{
+    std::ifstream input(fileName.c_str(), std::ios::binary | std::ios::in);
+
+    uint64_t magic = 0;
+    input.read((char *)&magic, sizeof(magic));
+
+    return input && magic == MAGIC;
+}
+
+
+
+void wavelet_matrix::access_queries(std::string &wmFileName, std::string &accessIndices, bool mmapped, unsigned threadCount, bool binary,
+                                    bool profile)
+{
+    query_drivers<wavelet_matrix>::access_queries(wmFileName, accessIndices, mmapped, threadCount, binary, profile);
+}
+
+
+
+void wavelet_matrix::rank_queries(std::string &wmFileName, std::string &queryIndices, bool mmapped, unsigned threadCount, bool binary,
+                                    bool profile)
+{
+    query_drivers<wavelet_matrix>::rank_queries(wmFileName, queryIndices, mmapped, threadCount, binary, profile);
+}
+
+
+
+void wavelet_matrix::select_queries(std::string &wmFileName, std::string &queryIndices, bool mmapped, unsigned threadCount, bool binary,
+                                    bool profile)
+{
+    query_drivers<wavelet_matrix>::select_queries(wmFileName, queryIndices, mmapped, threadCount, binary, profile);
+}
+
+
+
+#endif
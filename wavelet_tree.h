@@ -1,269 +1,1077 @@
+#ifndef WAVELET_TREE_H
+#define WAVELET_TREE_H
+
 #include<iostream>
 #include<fstream>
 #include<cstdio>
 #include<string>
-#include<map>
 #include<unordered_map>
 #include<cmath>
 #include<algorithm>
+#include<vector>
+#include<utility>
+#include<functional>
+#include<queue>
+#include<iterator>
 
 #include "select_support.h"
+#include "rrr_vector.h"
+#include "alphabet_map.h"
+#include "batch_executor.h"
+#include "query_drivers.h"
 
 
 class wavelet_tree
 {
 private:
-    uint8_t left;       // Left limit of the alphabet.
-    uint8_t right;      // Right limit of the alphabet.
-    bit_vector B;       // Bitvector at the root.
+    const static uint64_t MAGIC = 0x3530454552545457ULL;  // "WTTREE05", identifies a serialized tree.
+    const static uint64_t PAR_BUILD_LEN = 1 << 20;        // Min node length to partition in parallel.
+    const static uint8_t MAX_DEPTH = 32;                  // Max number of internal nodes on a root-to-leaf path.
+    const static uint64_t PREFETCH_DIST = 16;             // Number of queries to prefetch ahead in a batch rank.
+    const static uint64_t SELECT_BLOCK = 1024;            // Number of select queries to keep states for at a time.
+
+    uint32_t left;      // Left limit of the alphabet.
+    uint32_t right;     // Right limit of the alphabet.
+    uint32_t mid;       // Last character of the left subtree.
+    uint64_t len;       // Number of text characters in this tree.
+    bit_vector B;       // Bitvector at the root; empty at the leaves.
     uint8_t wrdSz;      // Bit-length for each text character.
-    bit_vector words;   // Text characters in this tree, in exact order.
+    bit_vector words;   // Text characters in this tree, in exact order; only kept during construction.
     wavelet_tree *wt_l; // Left subtree.
     wavelet_tree *wt_r; // Right subtree.
     rank_support r;     // Rank support for the bitvector B.
     select_support s;   // Select support on rank support r.
+    bool rrr;           // Whether the bitvector is kept RRR-compressed in C, instead of as B, r and s.
+    rrr_vector C;       // Compressed bitvector, with its own rank and select support.
+    wavelet_tree *nodes;    // At the root, all the other nodes of the tree, in preorder; NULL elsewhere.
+    mmap_reader *image;     // At the root, the index file read into memory, viewed by the bitvectors; or NULL.
+    uint8_t level;      // Depth of this node; for the operation counts of perf_counters.h.
+
+
+    wavelet_tree(const wavelet_tree &);
+    wavelet_tree &operator=(const wavelet_tree &);
+
+    void init(uint32_t l, uint32_t r, uint64_t len, uint8_t wrdSz);
+
+    template<typename T_text> void build_index(T_text &text, std::string &outputFile, unsigned threadCount, bool huffman);
+    static uint64_t huffman_codes(std::vector<uint64_t> &freq, alphabet_map &alphabet, std::vector<uint64_t> &code);
+    static uint32_t huffman_split(uint32_t l, uint32_t r, uint8_t depth, const std::vector<uint64_t> &code);
+    template<typename T_text> void build(T_text &text, alphabet_map &alphabet, unsigned threadCount, const std::vector<uint64_t> *code);
+    void build(uint32_t l, uint32_t r, uint8_t depth, const std::vector<uint64_t> *code, task_pool *pool, wavelet_tree *slots);
+    inline void place_subtrees(wavelet_tree *slots);
+    void partition(uint64_t start, uint64_t end, uint64_t posL, uint64_t endL, bool shared);
+    inline void put_word(uint64_t idx, uint32_t wrd, bool atomic);
+    void append_codes(std::vector<uint32_t> &codes);
+    inline bool get_bit(uint64_t idx) { return rrr ? C.get_bit(idx) : B.get_bit(idx); }
+    inline uint64_t access_rank(uint64_t idx, bool &bit);
+    inline uint64_t rank1(uint64_t idx) { count_node_op(level); return rrr ? C.rank1(idx) : r.rank1(idx); }
+    inline uint64_t rank0(uint64_t idx) { count_node_op(level); return rrr ? C.rank0(idx) : r.rank0(idx); }
+    inline uint64_t select1(uint64_t rank) { count_node_op(level); return rrr ? C.select1(rank) : s.select1(rank); }
+    inline uint64_t select0(uint64_t rank) { count_node_op(level); return rrr ? C.select0(rank) : s.select0(rank); }
+    inline void prefetch(uint64_t idx) { if(left < right) rrr ? C.prefetch(idx) : r.prefetch(idx); }
+    inline void prefetch_select(uint64_t rank, bool bit) { if(!rrr) s.prefetch(rank, bit); }
+    inline uint64_t ones_before(uint64_t idx) { return idx ? rank1(idx - 1) : 0; }
+    inline uint64_t slot(wavelet_tree *node) { return node == this ? 0 : node - nodes + 1; }
+    void serialize(std::ofstream &output, alphabet_map &alphabet);
+    void serialize_wavelet_tree(std::ofstream &output);
+    void rank(uint64_t *order, uint64_t qCount, std::vector<uint32_t> &ch, std::vector<uint64_t> &count);
+    template<typename T_input> bool deserialize_index(T_input &input, alphabet_map &alphabet);
+    uint64_t count_in(uint64_t b, uint64_t e, uint32_t lo, uint32_t hi);
+    bool next_value_in(uint64_t b, uint64_t e, uint32_t x, uint32_t &ch);
+    static bool load_ordered(std::string &wtFileName, wavelet_tree &wt, alphabet_map &alphabet, mmap_reader *mapping);
 
+    struct access_query;
+    struct select_query;
+    struct top_k_entry;
 
-    wavelet_tree(uint8_t l, uint8_t r, uint64_t len, uint8_t wrdSz);
-
-    void build(std::string &text, std::map<char, uint8_t> &charMap);
-    void build(uint8_t l, uint8_t r);
-    void serialize(std::ofstream &output, std::string &text, std::map<char, uint8_t> &charMap);
-    void serialize_wavelet_tree(std::ofstream &output);
+    friend class stream_builder;
 
 
 public:
-    wavelet_tree() {}
-    wavelet_tree(std::string &inputFile, std::string &outputFile);
-    wavelet_tree(std::string &text);
+    wavelet_tree() { rrr = false, wt_l = wt_r = nodes = NULL, image = NULL, level = 0; }
+    wavelet_tree(std::string &inputFile, std::string &outputFile, unsigned threadCount = 1, bool huffman = false, bool integers = false,
+                    bool compressed = false);
+    wavelet_tree(std::string &text, unsigned threadCount = 1, bool compressed = false);
+    wavelet_tree(std::vector<uint32_t> &text, unsigned threadCount = 1, bool compressed = false);
+
+    ~wavelet_tree() { delete[] nodes; delete image; }
+
+    uint64_t get_len() { return len; }
+    uint32_t access(uint64_t idx);
+    void access(std::vector<uint64_t> &indices, std::vector<uint32_t> &result);
+    uint64_t rank(uint32_t ch, uint64_t idx);
+    void rank(std::vector<std::pair<uint32_t, uint64_t>> &queries, std::vector<uint64_t> &result);
+    uint64_t select(uint32_t ch, uint64_t rank);
+    void select(std::vector<std::pair<uint32_t, uint64_t>> &queries, std::vector<uint64_t> &result);
+    bool range_quantile(uint64_t i, uint64_t j, uint64_t k, uint32_t &ch);
+    uint64_t range_count(uint64_t i, uint64_t j, uint32_t lo, uint32_t hi);
+    bool range_next_value(uint64_t i, uint64_t j, uint32_t x, uint32_t &ch);
+    void range_top_k(uint64_t i, uint64_t j, uint64_t k, std::vector<std::pair<uint32_t, uint64_t>> &result,
+                        const std::vector<uint32_t> *least = NULL);
+    void least_symbols(const alphabet_map &alphabet, std::vector<uint32_t> &least);
+    uint64_t size_in_bits();
+    template<typename T_text> bool append(const T_text &text, alphabet_map &alphabet);
+
+    void deserialize(std::string &waveletFile, alphabet_map &alphabet, mmap_reader *mapping = NULL);
+    template<typename T_input> void deserialize_wavelet_tree(T_input &input, wavelet_tree *slots = NULL);
+
+    static void access_queries(std::string &wtFileName, std::string &accessIndices, bool mmapped = false, unsigned threadCount = 1,
+                                bool binary = false, bool profile = false);
+    static void rank_queries(std::string &wtFileName, std::string &queryIndices, bool mmapped = false, unsigned threadCount = 1,
+                                bool binary = false, bool profile = false);
+    static void select_queries(std::string &wtFileName, std::string &queryIndices, bool mmapped = false, unsigned threadCount = 1,
+                                bool binary = false, bool profile = false);
+    static void quantile_queries(std::string &wtFileName, std::string &queriesFile, bool mmapped = false, bool profile = false);
+    static void count_queries(std::string &wtFileName, std::string &queriesFile, bool mmapped = false, bool profile = false);
+    static void next_value_queries(std::string &wtFileName, std::string &queriesFile, bool mmapped = false, bool profile = false);
+    static void top_k_queries(std::string &wtFileName, std::string &queriesFile, bool mmapped = false, bool profile = false);
+    static void append_text(std::string &wtFileName, std::string &inputFile, bool wholeFile = false);
+};
+
+
+
+// State of an access query in a batch; see run_interleaved.
+struct wavelet_tree::access_query
+{
+    wavelet_tree *node; // Node the query is at; the leaf of the answer in the end.
+    uint64_t idx;       // Index of the queried character in the node.
+
+    void start() { node -> prefetch(idx); }
+    bool step();
+};
+
+
+
+// State of a select query in a batch; see run_interleaved.
+struct wavelet_tree::select_query
+{
+    wavelet_tree *path[MAX_DEPTH];  // Internal nodes from the root to the leaf of the character.
+    uint8_t depth;      // Number of nodes on the path yet to be mapped up through.
+    uint32_t ch;        // Queried character.
+    uint64_t idx;       // Queried rank at first; then the index of the occurrence in the node.
+
+    void start();
+    bool step();
+};
+
 
-    uint64_t rank(uint64_t idx);
-    uint64_t select(uint8_t ch, uint64_t rank);
 
-    void deserialize(std::string &waveletFile, std::string &text, std::map<char, uint8_t> &charMap);
-    void deserialize_wavelet_tree(std::ifstream &input);
+// Subtree, with the range of a range_top_k query mapped to it; ordered by the count of
+// characters in the range, and then by the least symbol of the subtree.
+struct wavelet_tree::top_k_entry
+{
+    wavelet_tree *node;
+    uint64_t b;         // First index of the range in the node.
+    uint64_t e;         // End (exclusive) of the range in the node.
+    uint32_t least;     // Least symbol of the subtree; or its least code, if the codes follow the symbols.
 
-    static void access_queries(std::string &wtFileName, std::string &accessIndices);
-    static void rank_queries(std::string &wtFileName, std::string &queryIndices);
-    static void select_queries(std::string &wtFileName, std::string &queryIndices);
+    bool operator<(const top_k_entry &o) const
+    {
+        return e - b < o.e - o.b || (e - b == o.e - o.b && least > o.least);
+    }
 };
 
 
 
-wavelet_tree::wavelet_tree(std::string &inputFile, std::string &outputFile)
+wavelet_tree::wavelet_tree(std::string &inputFile, std::string &outputFile, unsigned threadCount, bool huffman, bool integers,
+                            bool compressed)
+{
+    // With compressed set, the node bitvectors are RRR-compressed.
+    rrr = compressed;
+    wt_l = wt_r = nodes = NULL, image = NULL, level = 0;
+
+    // Read in the text: a line of characters, or a sequence of integer symbols.
+
+    if(integers)
+    {
+        std::vector<uint32_t> text;
+        read_text(inputFile, text);
+
+        build_index(text, outputFile, threadCount, huffman);
+    }
+    else
+    {
+        std::string text;
+        read_text(inputFile, text);
+
+        build_index(text, outputFile, threadCount, huffman);
+    }
+}
+
+
+
+wavelet_tree::wavelet_tree(std::string &text, unsigned threadCount, bool compressed)
+{
+    rrr = compressed;
+    wt_l = wt_r = nodes = NULL, image = NULL, level = 0;
+
+    // Map the arbitrary alphabet to a [0, sigma) range, in the symbol order.
+
+    alphabet_map alphabet;
+    alphabet.build(text);
+
+    build(text, alphabet, threadCount, NULL);
+}
+
+
+
+wavelet_tree::wavelet_tree(std::vector<uint32_t> &text, unsigned threadCount, bool compressed)
 {
-    std::ifstream input(inputFile);
-    std::string text;
+    rrr = compressed;
+    wt_l = wt_r = nodes = NULL, image = NULL, level = 0;
 
+    alphabet_map alphabet;
+    alphabet.build(text);
 
-    // Read in the text.
+    build(text, alphabet, threadCount, NULL);
+}
 
-    std::getline(input, text);
-    input.close();
 
 
+template<typename T_text>
+void wavelet_tree::build_index(T_text &text, std::string &outputFile, unsigned threadCount, bool huffman)
+{
     // Map the arbitrary alphabet to a [0, sigma) range.
-    // Maintaining the lexicographical order (ASCII) here for ease of analysis and debug.
+    // Maintaining the lexicographical order (ASCII, or integer) here for ease of analysis and debug.
     // Any arbitrary ordering should suffice in practice.
 
-    uint8_t distinctChar = 0;
-    std::map<char, uint8_t> charMap;
+    alphabet_map alphabet;
+    alphabet.build(text);
+
+
+    // For a Huffman-shaped tree, the characters are remapped in the order of their codes.
+
+    std::vector<uint64_t> code;
+    uint64_t codeBits = 0;
+
+    if(huffman)
+    {
+        std::vector<uint64_t> freq(alphabet.size(), 0);
 
-    for(auto p = text.begin(); p != text.end(); ++p)
-        if(charMap.find(*p) == charMap.end())
-            charMap[*p] = 0;
+        for(uint64_t i = 0; i < text.size(); ++i)
+            freq[alphabet.code(symbol_at(text, i))]++;
 
-    for(auto p = charMap.begin(); p != charMap.end(); ++p)
-        p -> second = distinctChar++;
+        codeBits = huffman_codes(freq, alphabet, code);
+    }
 
 
     // Build the wavelet tree.
-    build(text, charMap);
+    build(text, alphabet, threadCount, huffman ? &code : NULL);
 
 
-    // Seralize the text, the character mapping, and the wavelet tree.
+    // Seralize the alphabet mapping, and the wavelet tree.
 
     std::ofstream output;
     output.open(outputFile.c_str(), std::ios::binary | std::ios::out);
 
-    serialize(output, text, charMap);
+    serialize(output, alphabet);
 
     output.close();
 
 
-    std::cout << "Size of the alphabet the tree is constructed over: " << (unsigned)distinctChar << "\n";
-    std::cout << "Number of characters in the input string: " << text.length() << "\n";
+    std::cout << "Size of the alphabet the tree is constructed over: " << alphabet.size() << "\n";
+    std::cout << "Number of characters in the input string: " << text.size() << "\n";
+
+    if(huffman && !text.empty())
+        std::cout << "Average Huffman code length: " << double(codeBits) / text.size() << " bits\n";
 }
 
 
 
-wavelet_tree::wavelet_tree(std::string &text)
+void wavelet_tree::init(uint32_t l, uint32_t r, uint64_t len, uint8_t wordSize)
 {
-    // Map the arbitrary alphabet to a [0, sigma) range.
-    // Maintaining the lexicographical order (ASCII) here for ease of analysis and debug.
-    // Any arbitrary ordering should suffice in practice.
+    left = l, right = r;
+    this -> len = len;
+    wrdSz = wordSize;
+    words.set_len(len * wordSize);
+}
+
+
 
-    uint8_t distinctChar = 0;
-    std::map<char, uint8_t> charMap;
+void wavelet_tree::place_subtrees(wavelet_tree *slots)
+{
+    // The nodes of a subtree are laid out in preorder from slots on: the left subtree first, and
+    // then the right one, after the 2 (mid - left + 1) - 1 nodes of the left. Thus a node's slot
+    // depends only on the shape; and a node's own subtrees start at the slot after it.
+
+    wt_l = slots;
+    wt_r = slots + 2 * (mid - left) + 1;
+    wt_l -> rrr = wt_r -> rrr = rrr;
+    wt_l -> level = wt_r -> level = level + 1;
+}
 
-    for(auto p = text.begin(); p != text.end(); ++p)
-        if(charMap.find(*p) == charMap.end())
-            charMap[*p] = 0;
 
-    for(auto p = charMap.begin(); p != charMap.end(); ++p)
-        p -> second = distinctChar++;
 
+uint64_t wavelet_tree::huffman_codes(std::vector<uint64_t> &freq, alphabet_map &alphabet, std::vector<uint64_t> &code)
+{
+    // Computes Huffman code lengths from the character frequencies; if some code is longer than
+    // MAX_DEPTH, the frequencies are halved (keeping them positive) until none is. The codes are
+    // then made canonical: ordered by length, and by character for the same length; and the
+    // characters are remapped to their ranks in this order. Thus the leaves of every subtree
+    // form a contiguous range of characters, like in the balanced shape. code[c] holds the
+    // code of the remapped character c, left-aligned in 64 bits; and freq[c] is reordered to
+    // its frequency. Returns the total length of the text's codes.
 
-    // Build the wavelet tree.
-    build(text, charMap);
+    uint64_t sigma = alphabet.size();
+
+
+    std::vector<uint8_t> codeLen(sigma, 0);
+    std::vector<uint64_t> weight(freq);
+
+    while(sigma > 1)
+    {
+        // Merge the two lightest subtrees repeatedly; the parent of a node has a greater id.
+
+        typedef std::pair<uint64_t, uint64_t> heap_entry;   // (weight, node id).
+        std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<heap_entry>> heap;
+        std::vector<uint64_t> parent(2 * sigma - 1);
+        std::vector<uint8_t> depth(2 * sigma - 1, 0);
+        uint64_t nextId = sigma;
+
+        for(uint64_t c = 0; c < sigma; ++c)
+            heap.push(std::make_pair(weight[c], c));
+
+        while(heap.size() > 1)
+        {
+            heap_entry a = heap.top(); heap.pop();
+            heap_entry b = heap.top(); heap.pop();
+
+            parent[a.second] = parent[b.second] = nextId;
+            heap.push(std::make_pair(a.first + b.first, nextId++));
+        }
+
+        uint64_t maxDepth = 0;
+
+        for(uint64_t v = 2 * sigma - 2; v-- > 0; )
+        {
+            depth[v] = std::min<uint64_t>(depth[parent[v]] + 1, 255);
+            if(v < sigma)
+                codeLen[v] = depth[v], maxDepth = std::max<uint64_t>(maxDepth, depth[v]);
+        }
+
+        if(maxDepth <= MAX_DEPTH)
+            break;
+
+        for(uint64_t c = 0; c < sigma; ++c)
+            weight[c] = (weight[c] + 1) / 2;
+    }
+
+
+    // Assign the canonical codes, and remap the characters.
+
+    std::vector<uint32_t> order(sigma);
+    for(uint64_t c = 0; c < sigma; ++c)
+        order[c] = c;
+
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return codeLen[a] < codeLen[b]; });
+
+
+    uint64_t nxtCode = 0, totalBits = 0;
+    uint8_t prevLen = 0;
+
+    code.assign(sigma, 0);
+
+    for(uint64_t i = 0; i < sigma; ++i)
+    {
+        uint8_t len = codeLen[order[i]];
+
+        nxtCode <<= (len - prevLen), prevLen = len;
+        if(len)
+            code[i] = nxtCode << (64 - len);
+        nxtCode++;
+
+        totalBits += freq[order[i]] * len;
+    }
+
+    alphabet.remap(order);
+
+    std::vector<uint64_t> newFreq(sigma);
+    for(uint64_t i = 0; i < sigma; ++i)
+        newFreq[i] = freq[order[i]];
+
+    freq.swap(newFreq);
+
+    return totalBits;
 }
 
 
 
-wavelet_tree::wavelet_tree(uint8_t l, uint8_t r, uint64_t len, uint8_t wordSize):
-    left(l),
-    right(r),
-    B(len),
-    wrdSz(wordSize),
-    words(len * wordSize)
+uint32_t wavelet_tree::huffman_split(uint32_t l, uint32_t r, uint8_t depth, const std::vector<uint64_t> &code)
 {
+    // The canonical codes of the characters [l, r] share their first depth bits, and are
+    // increasing; so the ones continuing with a 0 bit, going left, form a prefix of the range.
+
+    uint32_t mid = l;
+
+    while(mid + 1 < r && !((code[mid + 1] >> (63 - depth)) & 1))
+        mid++;
+
+    return mid;
 }
 
 
 
-void wavelet_tree::build(std::string &text, std::map<char, uint8_t> &charMap)
+template<typename T_text>
+void wavelet_tree::build(T_text &text, alphabet_map &alphabet, unsigned threadCount, const std::vector<uint64_t> *code)
 {
-    left = 0, right = charMap.size() - 1;
+    // An empty text makes a single leaf, like in stream_builder.
+    left = 0, right = std::max<uint64_t>(alphabet.size(), 1) - 1;
+    len = text.size();
 
-    B.set_len(text.length());
+    for(wrdSz = 0; (1ULL << wrdSz) < alphabet.size(); )
+        wrdSz++;
 
-    wrdSz = ceil(log2(charMap.size()));
-    words.set_len(text.length() * wrdSz);
+    words.set_len(len * wrdSz);
 
-    for(uint64_t i = 0; i < text.length(); ++i)
-        words.set_int(i * wrdSz, wrdSz, charMap[text[i]]);
+    for(uint64_t i = 0; i < len; ++i)
+        words.set_int(i * wrdSz, wrdSz, alphabet.code(symbol_at(text, i)));
 
-    build(0, charMap.size() - 1);
+    // The 2 sigma - 1 nodes of the tree are allocated at once; all but the root in one array.
+    nodes = new wavelet_tree[2 * right];
+
+    if(threadCount <= 1)
+    {
+        build(0, right, 0, code, NULL, nodes);
+        return;
+    }
+
+
+    // The subtrees are built as tasks of the pool; wait for all of them.
+
+    task_pool pool(threadCount);
+
+    build(0, right, 0, code, &pool, nodes);
+    pool.wait();
 }
 
 
 
-void wavelet_tree::build(uint8_t l, uint8_t r)
+void wavelet_tree::build(uint32_t l, uint32_t r, uint8_t depth, const std::vector<uint64_t> *code, task_pool *pool, wavelet_tree *slots)
 {
     // printf("build(%d, %d). text len = %d\n", (int)l, (int)r, (int)B.get_len());
 
     if(l == r)
-        return; // No need to build the bitvector, and can be left as is (all zeroes based on the initialization)
+    {
+        words.set_len(0);
+        return; // No bitvector required at the leaves; the length suffices.
+    }
+
+    B.set_len(len);
+
+    // The alphabet is halved, or split by the next bit of the Huffman codes.
+    mid = (code ? huffman_split(l, r, depth, *code) : l + (r - l) / 2);
+
+
+    // Partition the characters in chunks; in parallel with a pool, if the node is long enough.
+    // Every chunk spans a multiple of 64 characters, so covers whole words of B. The chunks
+    // count their characters going to the left subtree first, and then distribute them to
+    // the subtrees at the offsets given by the prefix sums of the counts.
+
+    uint64_t chunkCnt = (pool && len >= PAR_BUILD_LEN ? pool -> thread_count() * 4 : 1);
+    uint64_t chunkLen = ((len + chunkCnt - 1) / chunkCnt + 63) / 64 * 64;
+    chunkCnt = (len + chunkLen - 1) / chunkLen;
+
+    auto for_each_chunk = [&](const std::function<void(uint64_t)> &fn)
+        {
+            if(chunkCnt > 1)
+                pool -> parallel_for(chunkCnt, fn);
+            else
+                for(uint64_t c = 0; c < chunkCnt; ++c)
+                    fn(c);
+        };
 
-    uint8_t mid = (l + r) / 2;
-    uint64_t countL = 0, countR = 0, wordsVecSz = words.get_len();
 
-    for(uint64_t i = 0; i < wordsVecSz; i += wrdSz)
+    std::vector<uint64_t> chunkL(chunkCnt + 1, 0);
+
+    for_each_chunk([&](uint64_t c)
+        {
+            uint64_t end = std::min((c + 1) * chunkLen, len);
+
+            for(uint64_t i = c * chunkLen; i < end; ++i)
+                if(words.get_int(i * wrdSz, wrdSz) <= mid)
+                    chunkL[c + 1]++;
+        });
+
+    for(uint64_t c = 0; c < chunkCnt; ++c)
+        chunkL[c + 1] += chunkL[c];
+
+    uint64_t countL = chunkL[chunkCnt];
+
+
+    place_subtrees(slots);
+    wt_l -> init(l, mid, countL, wrdSz);
+    wt_r -> init(mid + 1, r, len - countL, wrdSz);
+
+    for_each_chunk([&](uint64_t c)
+        {
+            partition(c * chunkLen, std::min((c + 1) * chunkLen, len), chunkL[c], chunkL[c + 1], chunkCnt > 1);
+        });
+
+    
+    words.set_len(0);   // The characters are now distributed to the subtrees.
+
+    if(rrr)
     {
-        uint8_t wrd = words.get_int(i, wrdSz);
-        if(wrd <= mid)
-            countL++;
-        else
-            countR++;
+        C.build(B);
+        B.set_len(0);   // The compressed bitvector replaces B, and its rank and select supports.
+    }
+    else
+    {
+        (this -> r).build(&B, pool);
+        s.build(&(this -> r));
     }
 
 
-    wt_l = new wavelet_tree(l, mid, countL, wrdSz);
-    wt_r = new wavelet_tree(mid + 1, r, countR, wrdSz);
+    if(!pool)
+    {
+        wt_l -> build(l, mid, depth + 1, code, NULL, wt_l + 1);
+        wt_r -> build(mid + 1, r, depth + 1, code, NULL, wt_r + 1);
 
-    
-    countL = 0, countR = 0;
-    for(uint64_t i = 0; i < wordsVecSz; i += wrdSz)
+        return;
+    }
+
+    wavelet_tree *lt = wt_l, *rt = wt_r;
+    uint32_t m = mid;
+
+    pool -> submit([lt, l, m, depth, code, pool]() { lt -> build(l, m, depth + 1, code, pool, lt + 1); });
+    pool -> submit([rt, m, r, depth, code, pool]() { rt -> build(m + 1, r, depth + 1, code, pool, rt + 1); });
+}
+
+
+
+void wavelet_tree::partition(uint64_t start, uint64_t end, uint64_t posL, uint64_t endL, bool shared)
+{
+    // Distributes the characters [start, end) to the subtrees, to the positions [posL, endL)
+    // of the left one, and from the count of the preceding characters going right on of the
+    // right one. With shared set, the neighbouring chunks are partitioned concurrently; so the
+    // first and the last 64 characters written to a subtree may share a word with theirs.
+
+    uint64_t beginL = posL;
+    uint64_t posR = start - posL, beginR = posR, endR = end - endL;
+
+    for(uint64_t i = start; i < end; ++i)
     {
-        uint8_t wrd = words.get_int(i, wrdSz);
+        uint32_t wrd = words.get_int(i * wrdSz, wrdSz);
         if(wrd <= mid)
         {
-            B.reset_bit(i / wrdSz);
-            wt_l -> words.set_int(countL * wrdSz, wrdSz, wrd);
-            countL++;
+            wt_l -> put_word(posL, wrd, shared && (posL - beginL < 64 || endL - posL <= 64));
+            posL++;
         }
         else
         {
-            B.set_bit(i / wrdSz);
-            wt_r -> words.set_int(countR * wrdSz, wrdSz, wrd);
-            countR++;
+            B.set_bit(i);
+            wt_r -> put_word(posR, wrd, shared && (posR - beginR < 64 || endR - posR <= 64));
+            posR++;
         }
     }
+}
 
-    
-    (this -> r).build(&B);
-    s.build(&(this -> r));
 
 
-    wt_l -> build(l, mid);
-    wt_r -> build(mid + 1, r);
+void wavelet_tree::put_word(uint64_t idx, uint32_t wrd, bool atomic)
+{
+    if(atomic)
+        words.or_int_atomic(idx * wrdSz, wrdSz, wrd);
+    else
+        words.set_int(idx * wrdSz, wrdSz, wrd);
 }
 
 
 
-uint64_t wavelet_tree::rank(uint64_t idx)
+template<typename T_text>
+bool wavelet_tree::append(const T_text &text, alphabet_map &alphabet)
 {
-    if(left == right)
-        return idx <= B.get_len() ? idx + 1 : std::numeric_limits<uint64_t>::max();
+    // Appends the symbols of text to the end of the indexed text; the shape of the tree stays,
+    // so every symbol must be of the alphabet. Returns false, with the tree unchanged, if one is
+    // not, or if the bitvectors are RRR-compressed (hence static).
 
-    
-    bool bit = B.get_bit(idx);
+    std::vector<uint32_t> codes(text.size());
+
+    for(uint64_t i = 0; i < text.size(); ++i)
+        if(!alphabet.find(symbol_at(text, i), codes[i]))
+            return false;
+
+    if(rrr && left < right)
+        return false;
+
+    append_codes(codes);
+
+    return true;
+}
+
+
+
+void wavelet_tree::append_codes(std::vector<uint32_t> &codes)
+{
+    // Pushes the characters down from this node like build does: their bits are appended to B,
+    // and they go on to the subtrees in order. The rank and select supports are extended over
+    // the new bits only; so appending takes O(log sigma) amortized time per character.
+
+    uint64_t oldLen = len;
+    len += codes.size();
+
+    if(left == right || codes.empty())
+        return;
+
+    B.resize(len);
 
-    if(!bit)
+    std::vector<uint32_t> codesL, codesR;
+
+    for(uint64_t i = 0; i < codes.size(); ++i)
+        if(codes[i] > mid)
+        {
+            B.set_bit(oldLen + i);
+            codesR.push_back(codes[i]);
+        }
+        else
+            codesL.push_back(codes[i]);
+
+    std::vector<uint32_t>().swap(codes);    // The characters are now distributed to the subtrees.
+
+    r.extend();
+    s.extend(oldLen);
+
+    wt_l -> append_codes(codesL);
+    wt_r -> append_codes(codesR);
+}
+
+
+
+uint64_t wavelet_tree::access_rank(uint64_t idx, bool &bit)
+{
+    // Returns the number of bits equal to the one at idx in [0, idx], and sets bit to it; an
+    // RRR-compressed node decodes the block of idx once for both.
+
+    if(rrr)
     {
-        uint64_t rankVal = r.rank0(idx);
-        return wt_l -> rank(rankVal - 1);
+        count_node_op(level);
+
+        uint64_t ones = C.access_rank(idx, bit);
+        return bit ? ones : idx + 1 - ones;
     }
-    
 
-    uint64_t rankVal = r.rank1(idx);
-    return wt_r -> rank(rankVal - 1);
+    bit = B.get_bit(idx);
+    return bit ? rank1(idx) : rank0(idx);
+}
+
+
+
+uint32_t wavelet_tree::access(uint64_t idx)
+{
+    // Descend along the bits at idx, mapping idx to the subtrees, until a leaf.
+
+    wavelet_tree *node = this;
+    bool bit;
+
+    while(node -> left < node -> right)
+        idx = node -> access_rank(idx, bit) - 1, node = (bit ? node -> wt_r : node -> wt_l);
+
+    return node -> left;
+}
+
+
+
+bool wavelet_tree::access_query::step()
+{
+    if(node -> left == node -> right)
+        return false;
+
+    bool bit;
+    idx = node -> access_rank(idx, bit) - 1, node = (bit ? node -> wt_r : node -> wt_l);
+
+    node -> prefetch(idx);
+
+    return true;
 }
 
 
 
-uint64_t wavelet_tree::select(uint8_t ch, uint64_t rank)
+void wavelet_tree::access(std::vector<uint64_t> &indices, std::vector<uint32_t> &result)
+{
+    std::vector<access_query> queries(indices.size());
+
+    for(uint64_t i = 0; i < indices.size(); ++i)
+        queries[i].node = this, queries[i].idx = indices[i];
+
+    run_interleaved(queries);
+
+
+    result.resize(indices.size());
+    for(uint64_t i = 0; i < indices.size(); ++i)
+        result[i] = queries[i].node -> left;
+}
+
+
+
+uint64_t wavelet_tree::rank(uint32_t ch, uint64_t idx)
+{
+    // Descend along the bits of ch, mapping the count of characters in the prefix
+    // [0, idx] to the subtrees, until the leaf of ch.
+
+    wavelet_tree *node = this;
+    uint64_t count = (idx >= len ? len : idx + 1);   // Not min(idx + 1, len), which wraps at the max idx.
+
+    while(node -> left < node -> right && count)
+        if(ch <= node -> mid)
+            count = node -> rank0(count - 1), node = node -> wt_l;
+        else
+            count = node -> rank1(count - 1), node = node -> wt_r;
+
+    return count;
+}
+
+
+
+void wavelet_tree::rank(std::vector<std::pair<uint32_t, uint64_t>> &queries, std::vector<uint64_t> &result)
+{
+    // Order the queries by character, and then by index. Thus at each node, the queries
+    // descending to the left subtree form a prefix of the node's queries, and queries with
+    // the same character and index are adjacent; so those are answered only once.
+
+    uint64_t qCount = queries.size();
+    std::vector<uint64_t> order(qCount);
+    std::vector<uint32_t> ch(qCount);
+    std::vector<uint64_t> count(qCount);
+
+    for(uint64_t i = 0; i < qCount; ++i)
+    {
+        order[i] = i;
+        ch[i] = queries[i].first;
+        count[i] = (queries[i].second >= len ? len : queries[i].second + 1);
+    }
+
+    std::sort(order.begin(), order.end(), [&queries](uint64_t a, uint64_t b) { return queries[a] < queries[b]; });
+
+    rank(order.data(), qCount, ch, count);
+
+    result.swap(count);
+}
+
+
+
+void wavelet_tree::rank(uint64_t *order, uint64_t qCount, std::vector<uint32_t> &ch, std::vector<uint64_t> &count)
+{
+    if(left == right || !qCount)
+        return;
+
+    uint64_t countL = 0;
+    uint64_t prevIn = std::numeric_limits<uint64_t>::max(), prevOut = 0;
+    bool prevBit = 0;
+
+    for(uint64_t i = 0; i < qCount; ++i)
+    {
+        if(i + PREFETCH_DIST < qCount && count[order[i + PREFETCH_DIST]])
+            prefetch(count[order[i + PREFETCH_DIST]] - 1);
+
+        uint64_t q = order[i];
+        bool bit = (ch[q] > mid);
+
+        if(!bit)
+            countL++;
+
+        if(count[q] == prevIn && bit == prevBit)
+            count[q] = prevOut;
+        else
+        {
+            prevIn = count[q], prevBit = bit;
+            count[q] = (!count[q] ? 0 : bit ? rank1(count[q] - 1) : rank0(count[q] - 1));
+            prevOut = count[q];
+        }
+    }
+
+
+    wt_l -> rank(order, countL, ch, count);
+    wt_r -> rank(order + countL, qCount - countL, ch, count);
+}
+
+
+
+uint64_t wavelet_tree::select(uint32_t ch, uint64_t rank)
 {
     if(left == right)
-        return rank <= B.get_len() ? rank - 1 : std::numeric_limits<uint64_t>::max();
+        return rank <= len ? rank - 1 : std::numeric_limits<uint64_t>::max();
 
-    if(ch <= (left + right) / 2)
+    if(ch <= mid)
     {
         uint64_t nxtLvlIdx = wt_l -> select(ch, rank);
-        uint64_t currLvlIdx = s.select0(nxtLvlIdx + 1);
+        uint64_t currLvlIdx = select0(nxtLvlIdx + 1);
 
         return currLvlIdx;        
     }
 
     uint64_t nxtLvlIdx = wt_r -> select(ch, rank);
-    uint64_t currLvlIdx = s.select1(nxtLvlIdx + 1);
+    uint64_t currLvlIdx = select1(nxtLvlIdx + 1);
 
     return currLvlIdx;
 }
 
 
 
-void wavelet_tree::serialize(std::ofstream &output, std::string &text, std::map<char, uint8_t> &charMap)
+void wavelet_tree::select_query::start()
 {
-    // Serialize the text length, followed by the text itself.
-    // (Required for future access(idx) operations).
-    uint64_t textLen = text.length();
+    // Record the path down to the leaf of ch (only the hot node metadata is read), and map
+    // the rank to the index of the occurrence in the leaf.
 
-    output.write((const char *)&textLen, sizeof(textLen));
-    output.write(text.c_str(), text.length());
+    wavelet_tree *node = path[0];
 
+    for(depth = 0; node -> left < node -> right; )
+    {
+        path[depth++] = node;
+        node = (ch <= node -> mid ? node -> wt_l : node -> wt_r);
+    }
 
-    // Serialize the hash map size, followed by the hass map itself.
-    // (Required for future select(ch, rank) operations).
-    uint64_t mapSize = charMap.size();
-    
-    output.write((const char *)&mapSize, sizeof(mapSize));
-    for(auto p = charMap.begin(); p != charMap.end(); ++p)
+    if(!idx || idx > node -> len)
     {
-        output.write(&p -> first, sizeof(p -> first));
-        output.write((const char *)&p -> second, sizeof(p -> second));
+        idx = std::numeric_limits<uint64_t>::max(), depth = 0;
+        return;
     }
 
+    idx--;
+
+    if(depth)
+        path[depth - 1] -> prefetch_select(idx + 1, ch > path[depth - 1] -> mid);
+}
+
+
+
+bool wavelet_tree::select_query::step()
+{
+    if(!depth)
+        return false;
+
+    wavelet_tree *node = path[--depth];
+    bool bit = (ch > node -> mid);
+
+    idx = (bit ? node -> select1(idx + 1) : node -> select0(idx + 1));
+
+    if(!depth)
+        return false;
+
+    node = path[depth - 1];
+    node -> prefetch_select(idx + 1, ch > node -> mid);
+
+    return true;
+}
+
+
+
+void wavelet_tree::select(std::vector<std::pair<uint32_t, uint64_t>> &queries, std::vector<uint64_t> &result)
+{
+    // The query states hold whole paths; so those are kept for a block of queries at a time.
+
+    std::vector<select_query> q;
+    result.resize(queries.size());
+
+    for(uint64_t first = 0; first < queries.size(); first += SELECT_BLOCK)
+    {
+        uint64_t blkSz = std::min<uint64_t>(uint64_t(SELECT_BLOCK), queries.size() - first);   // A copy, as std::min would bind (ODR-use) SELECT_BLOCK.
+
+        q.resize(blkSz);
+        for(uint64_t i = 0; i < blkSz; ++i)
+            q[i].path[0] = this, q[i].ch = queries[first + i].first, q[i].idx = queries[first + i].second;
+
+        run_interleaved(q);
+
+        for(uint64_t i = 0; i < blkSz; ++i)
+            result[first + i] = q[i].idx;
+    }
+}
+
+
+
+bool wavelet_tree::range_quantile(uint64_t i, uint64_t j, uint64_t k, uint32_t &ch)
+{
+    // Finds the k-th (from 1) smallest character of [i, j]; returns whether k is in [1, j - i + 1],
+    // with j clamped to len - 1. Descends to the subtree holding it, keeping the range [b, e)
+    // mapped to the node.
+
+    if(i > j || i >= len)
+        return false;
+
+    j = std::min(j, len - 1);
+    if(!k || k > j - i + 1)
+        return false;
+
+    wavelet_tree *node = this;
+    uint64_t b = i, e = j + 1;
+
+    while(node -> left < node -> right)
+    {
+        uint64_t bOnes = node -> ones_before(b), eOnes = node -> ones_before(e);
+        uint64_t zeros = (e - eOnes) - (b - bOnes);
+
+        if(k <= zeros)
+            b -= bOnes, e -= eOnes, node = node -> wt_l;
+        else
+            k -= zeros, b = bOnes, e = eOnes, node = node -> wt_r;
+    }
+
+    ch = node -> left;
+    return true;
+}
+
+
+
+uint64_t wavelet_tree::range_count(uint64_t i, uint64_t j, uint32_t lo, uint32_t hi)
+{
+    // Returns the number of characters of [i, j] in [lo, hi].
+
+    if(i > j || i >= len || lo > hi)
+        return 0;
+
+    return count_in(i, std::min(j, len - 1) + 1, lo, hi);
+}
+
+
+
+uint64_t wavelet_tree::count_in(uint64_t b, uint64_t e, uint32_t lo, uint32_t hi)
+{
+    // Only the subtrees straddling lo or hi are descended into; at most two per level.
+
+    if(b == e || hi < left || right < lo)
+        return 0;
+
+    if(lo <= left && right <= hi)
+        return e - b;
+
+    uint64_t bOnes = ones_before(b), eOnes = ones_before(e);
+
+    return wt_l -> count_in(b - bOnes, e - eOnes, lo, hi) + wt_r -> count_in(bOnes, eOnes, lo, hi);
+}
+
+
+
+bool wavelet_tree::range_next_value(uint64_t i, uint64_t j, uint32_t x, uint32_t &ch)
+{
+    // Finds the smallest character of [i, j] that is at least x; returns whether one exists.
+
+    if(i > j || i >= len)
+        return false;
+
+    return next_value_in(i, std::min(j, len - 1) + 1, x, ch);
+}
+
+
+
+bool wavelet_tree::next_value_in(uint64_t b, uint64_t e, uint32_t x, uint32_t &ch)
+{
+    // The left subtree is tried first; a failing subtree fails at the subtrees straddling x
+    // or at empty ranges, so O(log sigma) nodes are visited.
+
+    if(b == e || right < x)
+        return false;
+
+    if(left == right)
+    {
+        ch = left;
+        return true;
+    }
+
+    uint64_t bOnes = ones_before(b), eOnes = ones_before(e);
+
+    return wt_l -> next_value_in(b - bOnes, e - eOnes, x, ch) || wt_r -> next_value_in(bOnes, eOnes, x, ch);
+}
+
+
+
+void wavelet_tree::range_top_k(uint64_t i, uint64_t j, uint64_t k, std::vector<std::pair<uint32_t, uint64_t>> &result,
+                                const std::vector<uint32_t> *least)
+{
+    // Collects the (up to) k most frequent characters of [i, j], with their counts; the more
+    // frequent, and for equal counts the one of the smaller symbol (given the least symbols of
+    // the subtrees, see least_symbols; else the smaller code), first. The subtrees are expanded
+    // best first: a leaf popped holds at least as many characters of the range as any subtree
+    // left in the queue, and a subtree as many has no smaller symbol; so every popped leaf is
+    // the next answer, after O(log sigma) pops.
+
+    result.clear();
+
+    if(i > j || i >= len || !k)
+        return;
+
+    std::priority_queue<top_k_entry> queue;
+    top_k_entry root = {this, i, std::min(j, len - 1) + 1, least ? (*least)[0] : left};
+
+    queue.push(root);
+
+    while(!queue.empty() && result.size() < k)
+    {
+        top_k_entry v = queue.top();
+        queue.pop();
+
+        wavelet_tree *node = v.node;
+
+        if(node -> left == node -> right)
+        {
+            result.push_back(std::make_pair(node -> left, v.e - v.b));
+            continue;
+        }
+
+        uint64_t bOnes = node -> ones_before(v.b), eOnes = node -> ones_before(v.e);
+        top_k_entry l = {node -> wt_l, v.b - bOnes, v.e - eOnes, least ? (*least)[slot(node -> wt_l)] : node -> wt_l -> left};
+        top_k_entry r = {node -> wt_r, bOnes, eOnes, least ? (*least)[slot(node -> wt_r)] : node -> wt_r -> left};
+
+        if(l.b < l.e)
+            queue.push(l);
+        if(r.b < r.e)
+            queue.push(r);
+    }
+}
+
+
+
+void wavelet_tree::least_symbols(const alphabet_map &alphabet, std::vector<uint32_t> &least)
+{
+    // Sets least[slot(v)] to the least symbol of the subtree of every node v, for range_top_k on
+    // a tree whose codes do not follow the symbols (Huffman-shaped). The nodes are visited in
+    // reverse preorder, so the subtrees before their roots; call on the root.
+
+    least.resize(2 * (right - left) + 1);
+
+    for(uint64_t v = least.size(); v-- > 0; )
+    {
+        wavelet_tree *node = (v ? nodes + v - 1 : this);
+
+        least[v] = (node -> left == node -> right ? alphabet.symbol(node -> left)
+                                                    : std::min(least[slot(node -> wt_l)], least[slot(node -> wt_r)]));
+    }
+}
+
+
+
+uint64_t wavelet_tree::size_in_bits()
+{
+    // Bits of the bitvectors, and their rank and select supports, over all the nodes.
+
+    if(left == right)
+        return 0;
+
+    uint64_t bits = (rrr ? C.size_in_bits() : B.get_len() + r.overhead() + s.overhead());
+
+    return bits + wt_l -> size_in_bits() + wt_r -> size_in_bits();
+}
+
+
+
+void wavelet_tree::serialize(std::ofstream &output, alphabet_map &alphabet)
+{
+    // Serialize the format identifier. The text itself is not stored; access(idx)
+    // operations are answered by the tree.
+    uint64_t magic = MAGIC;
+
+    output.write((const char *)&magic, sizeof(magic));
+
+
+    // Serialize the alphabet mapping.
+    // (Required for future access(idx) and select(ch, rank) operations).
+    alphabet.serialize(output);
+
+
+    // Serialize the kind of the node bitvectors: plain (0), or RRR-compressed (1).
+    uint8_t kind = rrr;
+
+    output.write((const char *)&kind, sizeof(kind));
+
 
     // Serialize the wavelet tree.
     serialize_wavelet_tree(output);
@@ -273,185 +1081,437 @@ void wavelet_tree::serialize(std::ofstream &output, std::string &text, std::map<
 
 void wavelet_tree::serialize_wavelet_tree(std::ofstream &output)
 {
-    
-
-    // Serialize the character range.
+    // Serialize the character range, and the number of characters.
 
     output.write((const char *)&left, sizeof(left));
     output.write((const char *)&right, sizeof(right));
+    output.write((const char *)&len, sizeof(len));
 
-    // Serialize the bitvector.
-    B.serialize(output);
+    // The leaves are fully described by their range and length.
+    if(left == right)
+        return;
 
-    // Serialize the word size in words bitvector.
-    output.write((const char *)&wrdSz, sizeof(wrdSz));
+    // Serialize the split of the alphabet; it encodes the shape (balanced, or Huffman) of the tree.
+    output.write((const char *)&mid, sizeof(mid));
 
-    // Serialize the words bitvector.
-    words.serialize(output);
 
-    
-    // Serialize the rank_support.
-    r.serialize(output);
+    // Serialize the compressed bitvector; it carries its own rank and select support.
+    if(rrr)
+        C.serialize(output);
+    else
+    {
+        // Serialize the bitvector.
+        B.serialize(output);
 
-    // No serialization required for the select_support.
+        // Serialize the rank_support.
+        r.serialize(output);
 
-    // Recursively serialize the left and right wavelet trees, if existent.
-    if(left < right)
-    {
-        wt_l -> serialize_wavelet_tree(output);
-        wt_r -> serialize_wavelet_tree(output);
+        // Serialize the select_support; so that loading need not rescan the bitvector.
+        s.serialize(output);
     }
+
+    // Recursively serialize the left and right wavelet trees.
+    wt_l -> serialize_wavelet_tree(output);
+    wt_r -> serialize_wavelet_tree(output);
 }
 
 
 
-void wavelet_tree::deserialize(std::string &waveletFile, std::string &text, std::map<char, uint8_t> &charMap)
+void wavelet_tree::deserialize(std::string &waveletFile, alphabet_map &alphabet, mmap_reader *mapping)
 {
-    std::ifstream input;
-    input.open(waveletFile.c_str(), std::ios::binary | std::ios::in);
+    // With a mapping provided, the file is memory-mapped and the bitvectors are viewed in
+    // place instead of being read in; the mapping must then outlive the tree. Otherwise the
+    // file is read into memory at once, and the bitvectors view that image alike; so they are
+    // contiguous, each next to its rank and select supports, and the tree owns the image.
+
+    bool ok;
+
+    if(mapping)
+        ok = mapping -> open(waveletFile);
+    else
+    {
+        delete image;
+        mapping = image = new mmap_reader();
+
+        ok = image -> load(waveletFile);
+    }
+
+    ok = ok && deserialize_index(*mapping, alphabet);
+
+    if(!ok)
+    {
+        std::cerr << "Unrecognized wavelet tree file " << waveletFile << "; rebuild it with this version.\n";
+        exit(1);
+    }
+}
+
+
 
+template<typename T_input>
+bool wavelet_tree::deserialize_index(T_input &input, alphabet_map &alphabet)
+{
     // std::cout << "Deserializing\n";
 
-    uint64_t textLen;
-    input.read((char *)&textLen, sizeof(textLen));
-    // std::cout << "text len = " << textLen << "\n";
+    uint64_t magic = 0;
+    input.read((char *)&magic, sizeof(magic));
 
-    char *s = new char[textLen + 1]();
-    input.read(s, textLen);
-    text = std::string(s);
-    // std::cout << "text: " << s << "\n";
+    if(!input || magic != MAGIC)
+        return false;
 
 
-    uint64_t mapSize;
-    input.read((char *)&mapSize, sizeof(mapSize));
-    // std::cout << "Map size = " << mapSize << "\n";
+    if(!alphabet.deserialize(input))
+        return false;
 
+    // std::cout << "Alphabet size = " << alphabet.size() << "\n";
 
-    for(uint64_t i = 0; i < mapSize; ++i)
-    {
-        char ch;
-        uint8_t val;
 
-        input.read(&ch, sizeof(ch));
-        input.read((char *)&val, sizeof(val));
+    uint8_t kind = 0;
+    input.read((char *)&kind, sizeof(kind));
 
-        charMap[ch] = val;
+    if(!input || kind > 1)
+        return false;
 
-        // std::cout << "Map " << ch << " " << (unsigned)val << "\n";
-    }
+    rrr = kind;
 
 
     deserialize_wavelet_tree(input);
 
-    input.close();
-
     // std::cout << "Deserialization completed.\n";
+
+    return (bool)input;
 }
 
 
 
-void wavelet_tree::deserialize_wavelet_tree(std::ifstream &input)
+template<typename T_input>
+void wavelet_tree::deserialize_wavelet_tree(T_input &input, wavelet_tree *slots)
 {
-    // Deserialize the character range.
+    // Deserialize the character range, and the number of characters.
 
     input.read((char *)&left, sizeof(left));
     input.read((char *)&right, sizeof(right));
+    input.read((char *)&len, sizeof(len));
 
     // std::cout << "Left = " << (unsigned)left << ", Right = " << (unsigned)right << "\n";
 
-    // Deserialize the bitvector.
+    if(left == right)
+        return;
+
+    // At the root, allocate all the other nodes at once; see place_subtrees.
+
+    if(!slots)
+    {
+        delete[] nodes;
+        slots = nodes = new wavelet_tree[2 * (right - left)];
+    }
 
-    B.deserialize(input);
 
-    // std::cout << "Bitvector length = " << B.get_len() << "\n";
-    // B.print();
+    // Deserialize the split of the alphabet.
 
-    // Deserialize the word size.
+    input.read((char *)&mid, sizeof(mid));
 
-    input.read((char *)&wrdSz, sizeof(wrdSz));
+    place_subtrees(slots);
 
-    // std::cout << "Word size = " << (unsigned)wrdSz << "\n";
 
-    // Deserialize the words bitvector.
-    
-    words.deserialize(input);
+    // Deserialize the compressed bitvector; or the bitvector, and its rank and select supports.
+
+    if(rrr)
+        C.deserialize(input);
+    else
+    {
+        B.deserialize(input);
+
+        // std::cout << "Bitvector length = " << B.get_len() << "\n";
+        // B.print();
+
+        // Deserialize the rank support, and pass the underlying bitvector B to it.
+
+        r.deserialize(&B, input);
+
+        // Deserialize the select support, and pass the deserialized rank support to it.
+
+        s.deserialize(&r, input);
+    }
+
+
+    // Recursively desrialize the left and the right wavelet subtrees.
+
+    wt_l -> deserialize_wavelet_tree(input, wt_l + 1);
+    wt_r -> deserialize_wavelet_tree(input, wt_r + 1);
+}
+
+
+
+void wavelet_tree::access_queries(std::string &wtFileName, std::string &accessIndices, bool mmapped, unsigned threadCount, bool binary,
+                                bool profile)
+{
+    query_drivers<wavelet_tree>::access_queries(wtFileName, accessIndices, mmapped, threadCount, binary, profile);
+}
 
-    // std::cout << "Words bitvector length = " << words.get_len() << "\n";
-    // words.print();
 
-    // Deserialize the rank support, and pass the underlying bitvector B to it.
 
-    r.deserialize(&B, input);
+void wavelet_tree::rank_queries(std::string &wtFileName, std::string &queryIndices, bool mmapped, unsigned threadCount, bool binary,
+                                bool profile)
+{
+    query_drivers<wavelet_tree>::rank_queries(wtFileName, queryIndices, mmapped, threadCount, binary, profile);
+}
 
-    // Pass the deserialized rank support to the select support.
 
-    s.build(&r);
 
+void wavelet_tree::select_queries(std::string &wtFileName, std::string &queryIndices, bool mmapped, unsigned threadCount, bool binary,
+                                bool profile)
+{
+    query_drivers<wavelet_tree>::select_queries(wtFileName, queryIndices, mmapped, threadCount, binary, profile);
+}
 
-    // Recursively desrialize the left and the right wavelet subtrees, if exist.
 
-    wt_l = new wavelet_tree();
-    wt_r = new wavelet_tree();
 
-    if(left < right)
+bool wavelet_tree::load_ordered(std::string &wtFileName, wavelet_tree &wt, alphabet_map &alphabet, mmap_reader *mapping)
+{
+    // The order-based range queries require the character codes to follow the symbol order;
+    // which the Huffman-shaped trees reorder.
+
+    wt.deserialize(wtFileName, alphabet, mapping);
+
+    if(alphabet.is_ordered())
+        return true;
+
+    std::cerr << "This query requires a tree built without --huffman.\n";
+    return false;
+}
+
+
+
+void wavelet_tree::quantile_queries(std::string &wtFileName, std::string &queriesFile, bool mmapped, bool profile)
+{
+    alphabet_map alphabet;
+
+    mmap_reader mapping;
+    wavelet_tree wt;
+    if(!load_ordered(wtFileName, wt, alphabet, mmapped ? &mapping : NULL))
+        exit(1);
+
+
+    // Each query is "i j k"; an empty line answers a query with k out of [1, j - i + 1] (j clamped
+    // to the text, like in the other range queries).
+
+    query_reader input(queriesFile);
+    result_writer output(std::cout);
+    uint64_t i, j, k;
+    uint32_t ch = 0;
+    uint64_t qCount = 0;
+
+    query_profile prof(profile);
+
+    while(input.read_int(i) && input.read_int(j) && input.read_int(k))
     {
-        wt_l -> deserialize_wavelet_tree(input);
-        wt_r -> deserialize_wavelet_tree(input);
+        qCount++;
+
+        if(wt.range_quantile(i, j, k, ch))
+            alphabet.append_symbol(output.line(), ch);
+
+        output.end_line();
     }
+
+    prof.finish(qCount, std::cerr);
 }
 
 
 
-void wavelet_tree::access_queries(std::string &wtFileName, std::string &accessIndices)
+void wavelet_tree::count_queries(std::string &wtFileName, std::string &queriesFile, bool mmapped, bool profile)
 {
-    std::string text;
-    std::map<char, uint8_t> charMap;
+    alphabet_map alphabet;
 
+    mmap_reader mapping;
     wavelet_tree wt;
-    wt.deserialize(wtFileName, text, charMap);
+    if(!load_ordered(wtFileName, wt, alphabet, mmapped ? &mapping : NULL))
+        exit(1);
 
-    
-    std::ifstream input(accessIndices);
-    uint64_t idx;
 
-    while(input >> idx)
-        std::cout << text[idx] << "\n";
+    // Each query is "i j lo hi"; the symbols [lo, hi] map to the codes [codeLo, codeHi).
+
+    query_reader input(queriesFile);
+    result_writer output(std::cout);
+    uint64_t i, j;
+    uint32_t lo, hi;
+    uint64_t qCount = 0;
+
+    query_profile prof(profile);
+
+    while(input.read_int(i) && input.read_int(j) && alphabet.read_symbol(input, lo) && alphabet.read_symbol(input, hi))
+    {
+        qCount++;
+
+        uint64_t codeLo = alphabet.count_less(lo);
+        uint64_t codeHi = (hi == std::numeric_limits<uint32_t>::max() ? alphabet.size() : alphabet.count_less(hi + 1));
+
+        append_int(output.line(), lo <= hi && codeLo < codeHi ? wt.range_count(i, j, codeLo, codeHi - 1) : 0);
+        output.end_line();
+    }
+
+    prof.finish(qCount, std::cerr);
 }
 
 
 
-void wavelet_tree::rank_queries(std::string &wtFileName, std::string &queryIndices)
+void wavelet_tree::next_value_queries(std::string &wtFileName, std::string &queriesFile, bool mmapped, bool profile)
 {
-    std::string text;
-    std::map<char, uint8_t> charMap;
+    alphabet_map alphabet;
 
+    mmap_reader mapping;
     wavelet_tree wt;
-    wt.deserialize(wtFileName, text, charMap);
+    if(!load_ordered(wtFileName, wt, alphabet, mmapped ? &mapping : NULL))
+        exit(1);
 
-    
-    std::ifstream input(queryIndices);
-    char ch;
-    uint64_t idx;
 
-    while(input >> ch >> idx)
-        std::cout << wt.rank(idx) << "\n";
+    // Each query is "i j x"; an empty line answers a query without a character >= x in [i, j].
+
+    query_reader input(queriesFile);
+    result_writer output(std::cout);
+    uint64_t i, j;
+    uint32_t x, ch = 0;
+    uint64_t qCount = 0;
+
+    query_profile prof(profile);
+
+    while(input.read_int(i) && input.read_int(j) && alphabet.read_symbol(input, x))
+    {
+        qCount++;
+
+        uint64_t code = alphabet.count_less(x);
+
+        if(code < alphabet.size() && wt.range_next_value(i, j, code, ch))
+            alphabet.append_symbol(output.line(), ch);
+
+        output.end_line();
+    }
+
+    prof.finish(qCount, std::cerr);
 }
 
 
 
-void wavelet_tree::select_queries(std::string &wtFileName, std::string &queryIndices)
+void wavelet_tree::top_k_queries(std::string &wtFileName, std::string &queriesFile, bool mmapped, bool profile)
 {
-    std::string text;
-    std::map<char, uint8_t> charMap;
+    alphabet_map alphabet;
 
+    mmap_reader mapping;
     wavelet_tree wt;
-    wt.deserialize(wtFileName, text, charMap);
+    wt.deserialize(wtFileName, alphabet, mmapped ? &mapping : NULL);
 
-    
-    std::ifstream input(queryIndices);
-    char ch;
-    uint64_t rank;
 
-    while(input >> ch >> rank)
-        std::cout << wt.select(charMap[ch], rank) << "\n";
+    // Each query is "i j k"; answered on a line of "symbol count" pairs, separated by tabs.
+
+    query_reader input(queriesFile);
+    result_writer output(std::cout);
+    uint64_t i, j, k;
+    std::vector<std::pair<uint32_t, uint64_t>> result;
+    uint64_t qCount = 0;
+
+    std::vector<uint32_t> least;    // Least symbols of the subtrees, for the ties; needed only if Huffman-shaped.
+    if(!alphabet.is_ordered())
+        wt.least_symbols(alphabet, least);
+
+    query_profile prof(profile);
+
+    while(input.read_int(i) && input.read_int(j) && input.read_int(k))
+    {
+        qCount++;
+
+        wt.range_top_k(i, j, k, result, least.empty() ? NULL : &least);
+
+        std::string &line = output.line();
+
+        for(uint64_t t = 0; t < result.size(); ++t)
+        {
+            if(t)
+                line += '\t';
+
+            alphabet.append_symbol(line, result[t].first);
+            line += ' ';
+            append_int(line, result[t].second);
+        }
+
+        output.end_line();
+    }
+
+    prof.finish(qCount, std::cerr);
 }
+
+
+
+void wavelet_tree::append_text(std::string &wtFileName, std::string &inputFile, bool wholeFile)
+{
+    // Loads the index, appends the text of inputFile (a line of characters, or a sequence of
+    // integer symbols, like the index was built from; or with wholeFile set, all the characters
+    // of the file, like stream_builder indexes them) to it, and saves it over the old one. The
+    // index is written to a temporary file first, and renamed over the old one; so a failure
+    // leaves the old index intact.
+
+    alphabet_map alphabet;
+
+    wavelet_tree wt;
+    wt.deserialize(wtFileName, alphabet);
+
+    if(wt.rrr && wt.left < wt.right)
+    {
+        std::cerr << "An index built with --rrr is static; rebuild it over the whole text instead.\n";
+        exit(1);
+    }
+
+    uint64_t appended;
+    bool ok;
+
+    if(alphabet.is_bytes())
+    {
+        std::string text;
+
+        if(wholeFile)
+        {
+            std::ifstream input(inputFile.c_str(), std::ios::binary);
+            text.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        }
+        else
+            read_text(inputFile, text);
+
+        ok = wt.append(text, alphabet), appended = text.size();
+    }
+    else
+    {
+        std::vector<uint32_t> text;
+        read_text(inputFile, text);
+
+        ok = wt.append(text, alphabet), appended = text.size();
+    }
+
+    if(!ok)
+    {
+        std::cerr << "The text to append has symbols out of the alphabet of the index; rebuild it over the whole text instead.\n";
+        exit(1);
+    }
+
+
+    std::string tempFile = wtFileName + ".append";
+
+    std::ofstream output;
+    output.open(tempFile.c_str(), std::ios::binary | std::ios::out);
+
+    wt.serialize(output, alphabet);
+
+    output.close();
+
+    if(!output || rename(tempFile.c_str(), wtFileName.c_str()))
+    {
+        std::cerr << "Unable to write the index " << wtFileName << ".\n";
+        remove(tempFile.c_str());
+        exit(1);
+    }
+
+
+    std::cout << "Number of characters appended: " << appended << "\n";
+    std::cout << "Number of characters in the index: " << wt.get_len() << "\n";
+}
+
+
+
+#endif
@@ -4,6 +4,35 @@
 #include<string>
 
 #include "wavelet_tree.h"
+#include "wavelet_matrix.h"
+#include "stream_builder.h"
+#include "query_server.h"
+
+
+
+// Returns whether the optional flag is present among the command-line arguments
+// following the positional ones.
+bool has_flag(int argc, char *argv[], int firstOpt, const char *flag)
+{
+    for(int i = firstOpt; i < argc; ++i)
+        if(!strcmp(argv[i], flag))
+            return true;
+
+    return false;
+}
+
+
+
+// Returns the value following the optional flag among the command-line arguments following
+// the positional ones, or defaultVal if the flag is absent.
+uint64_t get_option(int argc, char *argv[], int firstOpt, const char *flag, uint64_t defaultVal)
+{
+    for(int i = firstOpt; i + 1 < argc; ++i)
+        if(!strcmp(argv[i], flag))
+            return strtoull(argv[i + 1], NULL, 10);
+
+    return defaultVal;
+}
 
 
 int main(int argc, char *argv[])
@@ -20,28 +49,176 @@ int main(int argc, char *argv[])
         std::string inputFile(argv[2]);
         std::string outputFile(argv[3]);
 
-        wavelet_tree(inputFile, outputFile);
+        unsigned threadCount = get_option(argc, argv, 4, "--threads", 1);
+        bool huffman = has_flag(argc, argv, 4, "--huffman");
+        bool integers = has_flag(argc, argv, 4, "--integers");
+        bool rrr = has_flag(argc, argv, 4, "--rrr");
+
+        if(has_flag(argc, argv, 4, "--matrix"))
+        {
+            if(huffman)
+            {
+                puts("--huffman applies to wavelet trees only.");
+                exit(1);
+            }
+
+            if(has_flag(argc, argv, 4, "--stream"))
+            {
+                puts("--stream applies to wavelet trees only.");
+                exit(1);
+            }
+
+            if(rrr)
+            {
+                puts("--rrr applies to wavelet trees only.");
+                exit(1);
+            }
+
+            wavelet_matrix(inputFile, outputFile, threadCount, integers);
+        }
+        else if(has_flag(argc, argv, 4, "--stream"))
+        {
+            if(rrr)
+            {
+                puts("--rrr does not apply to --stream.");
+                exit(1);
+            }
+
+            // Out-of-core construction, within a memory budget given in MB.
+            uint64_t memoryBudget = get_option(argc, argv, 4, "--memory", 256) << 20;
+
+            stream_builder(inputFile, outputFile, memoryBudget, huffman, integers);
+        }
+        else
+            wavelet_tree(inputFile, outputFile, threadCount, huffman, integers, rrr);
     }
     else if(!strcmp(argv[1], "access"))
     {
         std::string wtFile(argv[2]);
         std::string indicesFile(argv[3]);
 
-        wavelet_tree::access_queries(wtFile, indicesFile);
+        bool mmapped = has_flag(argc, argv, 4, "--mmap");
+        unsigned threadCount = get_option(argc, argv, 4, "--threads", 1);
+        bool binary = has_flag(argc, argv, 4, "--binary");
+        bool profile = has_flag(argc, argv, 4, "--perf");
+
+        if(wavelet_matrix::is_wavelet_matrix(wtFile))
+            wavelet_matrix::access_queries(wtFile, indicesFile, mmapped, threadCount, binary, profile);
+        else
+            wavelet_tree::access_queries(wtFile, indicesFile, mmapped, threadCount, binary, profile);
     }
     else if(!strcmp(argv[1], "rank"))
     {
         std::string wtFile(argv[2]);
         std::string queriesFile(argv[3]);
 
-        wavelet_tree::rank_queries(wtFile, queriesFile);
+        bool mmapped = has_flag(argc, argv, 4, "--mmap");
+        unsigned threadCount = get_option(argc, argv, 4, "--threads", 1);
+        bool binary = has_flag(argc, argv, 4, "--binary");
+        bool profile = has_flag(argc, argv, 4, "--perf");
+
+        if(wavelet_matrix::is_wavelet_matrix(wtFile))
+            wavelet_matrix::rank_queries(wtFile, queriesFile, mmapped, threadCount, binary, profile);
+        else
+            wavelet_tree::rank_queries(wtFile, queriesFile, mmapped, threadCount, binary, profile);
     }
     else if(!strcmp(argv[1], "select"))
     {
         std::string wtFile(argv[2]);
         std::string queriesFile(argv[3]);
 
-        wavelet_tree::select_queries(wtFile, queriesFile);
+        bool mmapped = has_flag(argc, argv, 4, "--mmap");
+        unsigned threadCount = get_option(argc, argv, 4, "--threads", 1);
+        bool binary = has_flag(argc, argv, 4, "--binary");
+        bool profile = has_flag(argc, argv, 4, "--perf");
+
+        if(wavelet_matrix::is_wavelet_matrix(wtFile))
+            wavelet_matrix::select_queries(wtFile, queriesFile, mmapped, threadCount, binary, profile);
+        else
+            wavelet_tree::select_queries(wtFile, queriesFile, mmapped, threadCount, binary, profile);
+    }
+    else if(!strcmp(argv[1], "quantile") || !strcmp(argv[1], "count") || !strcmp(argv[1], "next") || !strcmp(argv[1], "topk"))
+    {
+        std::string wtFile(argv[2]);
+        std::string queriesFile(argv[3]);
+
+        bool mmapped = has_flag(argc, argv, 4, "--mmap");
+        bool profile = has_flag(argc, argv, 4, "--perf");
+
+        if(wavelet_matrix::is_wavelet_matrix(wtFile))
+        {
+            puts("Range queries apply to wavelet trees only.");
+            exit(1);
+        }
+
+        if(!strcmp(argv[1], "quantile"))
+            wavelet_tree::quantile_queries(wtFile, queriesFile, mmapped, profile);
+        else if(!strcmp(argv[1], "count"))
+            wavelet_tree::count_queries(wtFile, queriesFile, mmapped, profile);
+        else if(!strcmp(argv[1], "next"))
+            wavelet_tree::next_value_queries(wtFile, queriesFile, mmapped, profile);
+        else
+            wavelet_tree::top_k_queries(wtFile, queriesFile, mmapped, profile);
+    }
+    else if(!strcmp(argv[1], "append"))
+    {
+        // Extend a saved tree with more text, in place of rebuilding it over the whole text.
+
+        std::string wtFile(argv[2]);
+        std::string inputFile(argv[3]);
+
+        if(wavelet_matrix::is_wavelet_matrix(wtFile))
+        {
+            puts("append applies to wavelet trees only.");
+            exit(1);
+        }
+
+        wavelet_tree::append_text(wtFile, inputFile, has_flag(argc, argv, 4, "--whole"));
+    }
+    else if(!strcmp(argv[1], "serve"))
+    {
+        // Load the index once; then answer requests from stdin, or from the clients of a socket.
+
+        std::string wtFile(argv[2]);
+        std::string socketPath;
+
+        bool mmapped = has_flag(argc, argv, 3, "--mmap");
+
+        for(int i = 3; i + 1 < argc; ++i)
+            if(!strcmp(argv[i], "--socket"))
+                socketPath = argv[i + 1];
+
+        alphabet_map alphabet;
+        mmap_reader mapping;
+        bool ok = true;
+
+        if(wavelet_matrix::is_wavelet_matrix(wtFile))
+        {
+            wavelet_matrix wm;
+            wm.deserialize(wtFile, alphabet, mmapped ? &mapping : NULL);
+
+            query_server<wavelet_matrix> server(wm, alphabet);
+
+            if(socketPath.empty())
+                server.serve_stream(0, 1);
+            else
+                ok = server.serve_socket(socketPath);
+        }
+        else
+        {
+            wavelet_tree wt;
+            wt.deserialize(wtFile, alphabet, mmapped ? &mapping : NULL);
+
+            query_server<wavelet_tree> server(wt, alphabet);
+
+            if(socketPath.empty())
+                server.serve_stream(0, 1);
+            else
+                ok = server.serve_socket(socketPath);
+        }
+
+        if(!ok)
+            exit(1);
     }
     else
         puts("Invalid command.");